@@ -10,113 +10,598 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "../libcs50/file.h"
 #include "../libcs50/mem.h"
 #include "../structures/structures.h"
 #include "grid.h"
 
 /************* grid *************/
+/* The symbols are a single row-major buffer; row y starts at
+ * y * stride. Each symbol row is null-terminated, so stride
+ * is width + 1. main_grid holds row pointers into the buffer,
+ * kept for get_main_grid.
+ *
+ * Gold is sparse: gold maps the spot index of each pile to its
+ * nugget count, and gold_bits has one bit per spot, set where
+ * there is a pile, so most spots are ruled out with one load.
+ * Both are only allocated once gold is placed.
+ *
+ * cell_class holds the cell class (GridRoom, ...) of every spot
+ * of the terrain, laid out like cells, so a class test is one
+ * load and one mask.
+ *
+ * A layered grid (see grid_new_layer) borrows the cells of its
+ * base and keeps only the symbols that differ from the base in
+ * its overlay, keyed by spot index y * stride + x. It also
+ * keeps an index of its free cells, the room cells showing '.':
+ * free_cells lists their spot indices in no order, and
+ * free_where gives, for the spot index of each room cell, where
+ * it is in free_cells, or -1 if it is not free; it has an entry
+ * for every spot, so finding one takes no search.
+ *
+ * A grid loaded from a compiled map keeps the file mapped; its
+ * cells, class table, room list and visibility data live there.
+ */
 typedef struct grid {
+  char* cells;
   char** main_grid;
-  int** gold_grid;
+  intmap_t* gold;        // spot index -> nuggets, or NULL before any gold
+  unsigned char* gold_bits;   // one bit per spot index: is there gold?
+  grid_t* base;          // terrain the cells belong to, or NULL
+  intmap_t* overlay;     // symbols placed over the base, or NULL
+  const unsigned char* classes;   // cell class of each symbol
+  unsigned char* cell_class;      // cell class of each spot of the terrain
+  int* rooms;            // spot index of every room cell, or NULL until asked for
+  int nrooms;
+  int* free_cells;       // a layer's free cells, by spot index
+  int nfree;
+  int* free_where;       // per spot index of a room cell: its place in free_cells, or -1
+  const void* visibility;         // precomputed visibility data, or NULL
+  size_t visibility_size;
+  void* mapping;         // the compiled map file, or NULL
+  size_t mapping_size;
   int height;
   int width;
+  int stride;
 } grid_t;
 
+/************* compiled_header_t *************/
+/* Start of a compiled map file. Each section is at its offset
+ * from the start of the file, 8-byte aligned. The layout is the
+ * host's own; CompiledVersion changes whenever it does.
+ */
+typedef struct compiled_header {
+  char magic[8];              // CompiledMagic
+  uint32_t version;           // CompiledVersion
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  uint64_t source_hash;       // hash of the map file compiled
+  uint64_t cells_offset;      // height * stride symbols, rows null-terminated
+  uint64_t classes_offset;    // 256 cell classes, one per symbol
+  uint64_t cell_class_offset; // height * stride cell classes, one per spot
+  uint64_t rooms_offset;      // nrooms spot indices
+  uint64_t nrooms;
+  uint64_t visibility_offset; // visibility_size bytes from the vision module
+  uint64_t visibility_size;
+} compiled_header_t;
+
+/************* compose_t *************/
+/* where grid_compose is writing, for compose_overlay */
+typedef struct compose {
+  char* dest;
+  int dest_stride;
+  int stride;
+} compose_t;
+
+/**************** file-local constants ****************/
+/* the cell class of each symbol; 0 for those a map may not contain */
+static const unsigned char CellClass[256] = {
+  [' '] = GridSolid, ['-'] = GridWall, ['|'] = GridWall, ['+'] = GridWall,
+  ['.'] = GridRoom, ['#'] = GridPassage,
+};
+
+static const char CompiledMagic[8] = "NUGMAPC";
+static const uint32_t CompiledVersion = 2;
+
+/**************** local functions ****************/
+static grid_t* grid_alloc(int width, int height);
+static grid_t* grid_parse(const char* data, size_t size, const char* mapFile);
+static char* map_file(const char* fileName, size_t* size, bool quiet);
+static uint64_t hash_bytes(const char* data, size_t size);
+static grid_t* grid_from_compiled(char* data, size_t size, uint64_t source_hash);
+static bool write_section(FILE* fp, const void* data, size_t size, uint64_t* offset);
+static void update_free(grid_t* grid, int index, char c);
+static void compose_overlay(void* arg, uint64_t key, int value);
+
+/**************** grid_alloc ****************/
+/* Allocates a grid of the given size with every symbol
+ * '\0' and no gold.
+ */
+static grid_t*
+grid_alloc(int width, int height)
+{
+    grid_t* grid = mem_malloc_assert(sizeof(grid_t), "grid");
+    grid->height = height;
+    grid->width = width;
+    grid->stride = width + 1;   // room for each row's null terminator
+    grid->cells = mem_calloc_assert((size_t)height * grid->stride + 1, sizeof(char),
+                                    "grid cells");
+    grid->cell_class = mem_calloc_assert((size_t)height * grid->stride + 1, 1,
+                                         "grid cell classes");
+    grid->main_grid = mem_malloc_assert((height + 1) * sizeof(char*), "grid rows");
+    for (int i = 0; i < height; i++) {
+        grid->main_grid[i] = grid->cells + i * grid->stride;
+    }
+    grid->gold = NULL;
+    grid->gold_bits = NULL;
+    grid->base = NULL;
+    grid->overlay = NULL;
+    grid->classes = CellClass;
+    grid->rooms = NULL;
+    grid->nrooms = 0;
+    grid->free_cells = NULL;
+    grid->nfree = 0;
+    grid->free_where = NULL;
+    grid->visibility = NULL;
+    grid->visibility_size = 0;
+    grid->mapping = NULL;
+    grid->mapping_size = 0;
+    return grid;
+}
+
 /**************** grid_new ****************/
 /* see grid.h for description */
 grid_t*
 grid_new(char* mapFile)
 {
-    // make sure mapFile can be open to be read
-    FILE* file = fopen(mapFile, "r");
-    if (file == NULL)
+    // make sure mapFile can be open to be read, and map it in whole
+    size_t size;
+    char* data = map_file(mapFile, &size, false);
+    if (data == NULL)
     {
-        fprintf(stderr, "Error: unable to open %s\n", mapFile);
         return NULL;
     }
-    // obtain map dimensions before copying map into 2D array
-    int grid_width = 0;      // number of characters in line
-    int grid_height = 0;     // number of lines
-    // read the first line to determine the width
-    char *line = file_readLine(file);
-    if (line != NULL) {
-        grid_width = strlen(line);
-        grid_height++;
-        free(line);
-    }
-    // Count remaining lines to determine the height
-    while ((line = file_readLine(file)) != NULL) {
-        grid_height++;
-        free(line);
-    }
-    // reset file pointer to beginning of map file
-    rewind(file);
-    // copy file contents into 2D char* array (main_grid)
-    // allocate memory for 2D array
-    char** map = grid_new_blank_array(grid_width, grid_height);
-    // Read character by character and copy to the 2D array
-    int row = 0;
-    int col = 0;
-    char ch;
-    while ((ch = fgetc(file)) != EOF && row < grid_height) {
-        // Check for newline to move to the next row
-        if (ch == '\n') {
-            // Null-terminate the current line
-            map[row][col] = '\0';  
-            row++;
-            col = 0;
-        } else {
-            if (col < grid_width) {
-                map[row][col] = ch;
-                col++;
-            }
+    grid_t* grid = grid_parse(data, size, mapFile);
+    munmap(data, size);
+    return grid;
+}
+
+/**************** grid_load_compiled ****************/
+/* see grid.h for description */
+grid_t*
+grid_load_compiled(char* compiledFile, char* mapFile)
+{
+    if (compiledFile == NULL || mapFile == NULL) {
+        return NULL;
+    }
+    size_t size;
+    char* data = map_file(mapFile, &size, false);
+    if (data == NULL) {
+        return NULL;
+    }
+    uint64_t source_hash = hash_bytes(data, size);
+
+    // use the compiled map if it was compiled from this very map
+    size_t compiled_size;
+    char* compiled = map_file(compiledFile, &compiled_size, true);
+    if (compiled != NULL) {
+        grid_t* grid = grid_from_compiled(compiled, compiled_size, source_hash);
+        if (grid != NULL) {
+            munmap(data, size);
+            return grid;
         }
+        fprintf(stderr, "%s is stale or damaged; loading %s instead\n", compiledFile, mapFile);
+        munmap(compiled, compiled_size);
     }
-    fclose(file);
-    // null-terminate last line if partially filled
-    if (row < grid_height && col > 0) {
-        map[row][col] = '\0';
-    }
-    grid_t* grid = mem_malloc(sizeof(grid_t));
-    grid->main_grid = map;
-    grid->height = grid_height;
-    grid->width = grid_width;
-
-    // inialize gold_grid and set values to 0
-    // allocate memory for 2D array
-    int** gold_map = mem_malloc(grid_height * sizeof(int*));
-    if (gold_map == NULL) {
-        fprintf(stderr, "Failed to allocate memory for gold_grid");
-        exit(1);
+
+    // otherwise fall back to the text map
+    grid_t* grid = grid_parse(data, size, mapFile);
+    munmap(data, size);
+    return grid;
+}
+
+/**************** grid_write_compiled ****************/
+/* see grid.h for description */
+bool
+grid_write_compiled(grid_t* grid, char* mapFile, char* compiledFile,
+                    const void* visibility, size_t visibility_size)
+{
+    if (grid == NULL || grid->base != NULL || mapFile == NULL || compiledFile == NULL
+        || (visibility == NULL && visibility_size > 0)) {
+        return false;
     }
-    for (int i = 0; i < grid_height; i++) 
+    size_t size;
+    char* data = map_file(mapFile, &size, false);
+    if (data == NULL) {
+        return false;
+    }
+    compiled_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CompiledMagic, sizeof(header.magic));
+    header.version = CompiledVersion;
+    header.width = grid->width;
+    header.height = grid->height;
+    header.stride = grid->stride;
+    header.source_hash = hash_bytes(data, size);
+    munmap(data, size);
+
+    int nrooms;
+    const int* rooms = grid_get_rooms(grid, &nrooms);
+    header.nrooms = nrooms;
+    header.visibility_size = visibility_size;
+
+    FILE* fp = fopen(compiledFile, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: unable to write %s\n", compiledFile);
+        return false;
+    }
+    // the header goes first, then again once the offsets are known
+    uint64_t header_offset;
+    bool ok = write_section(fp, &header, sizeof(header), &header_offset)
+        && write_section(fp, grid->cells, (size_t)grid->height * grid->stride,
+                         &header.cells_offset)
+        && write_section(fp, grid->classes, 256, &header.classes_offset)
+        && write_section(fp, grid->cell_class, (size_t)grid->height * grid->stride,
+                         &header.cell_class_offset)
+        && write_section(fp, rooms, nrooms * sizeof(int), &header.rooms_offset)
+        && write_section(fp, visibility, visibility_size, &header.visibility_offset)
+        && fseek(fp, header_offset, SEEK_SET) == 0
+        && fwrite(&header, sizeof(header), 1, fp) == 1;
+    if (fclose(fp) != 0 || !ok) {
+        fprintf(stderr, "Error: unable to write %s\n", compiledFile);
+        return false;
+    }
+    return true;
+}
+
+/**************** grid_compiled_name ****************/
+/* see grid.h for description */
+char*
+grid_compiled_name(char* mapFile)
+{
+    if (mapFile == NULL) {
+        return NULL;
+    }
+    size_t length = strlen(mapFile);
+    if (length >= 4 && strcmp(mapFile + length - 4, ".txt") == 0) {
+        length -= 4;
+    }
+    char* name = mem_malloc_assert(length + strlen(".mapc") + 1, "grid_compiled_name");
+    memcpy(name, mapFile, length);
+    strcpy(name + length, ".mapc");
+    return name;
+}
+
+/**************** map_file ****************/
+/* Maps the whole of a non-empty file into memory, privately and
+ * writable (changes are never written back), storing its size
+ * in *size. Returns NULL, with a message unless quiet, if the
+ * file cannot be opened, is empty or cannot be mapped.
+ */
+static char*
+map_file(const char* fileName, size_t* size, bool quiet)
+{
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
     {
-        gold_map[i] = mem_malloc((grid_width)*sizeof(int));  
-        if (gold_map[i] == NULL) {
-            perror("Failed to allocate memory for row");
-            // Free previously allocated rows to avoid memory leaks
-            for (int j = 0; j < i; j++) {
-                mem_free(gold_map[j]);
+        if (!quiet) {
+            fprintf(stderr, "Error: unable to open %s\n", fileName);
+        }
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        if (!quiet) {
+            fprintf(stderr, "Error: %s is empty or unreadable\n", fileName);
+        }
+        close(fd);
+        return NULL;
+    }
+    *size = info.st_size;
+    char* data = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        if (!quiet) {
+            fprintf(stderr, "Error: unable to map %s\n", fileName);
+        }
+        return NULL;
+    }
+    return data;
+}
+
+/**************** hash_bytes ****************/
+/* Returns the 64-bit FNV-1a hash of size bytes at data.
+ */
+static uint64_t
+hash_bytes(const char* data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**************** grid_from_compiled ****************/
+/* Builds a grid over a mapped compiled map of the given size,
+ * which the grid then owns. Returns NULL, leaving the mapping
+ * alone, if the file is not a compiled map from this build, was
+ * not compiled from a map with the given hash, or is damaged:
+ * every spot's class must be that of its symbol, every row must
+ * end in a null, and the room list must be exactly the room
+ * spots, in order.
+ */
+static grid_t*
+grid_from_compiled(char* data, size_t size, uint64_t source_hash)
+{
+    // check the header and that every section lies within the file
+    compiled_header_t* header = (compiled_header_t*)data;
+    if (size < sizeof(*header)
+        || memcmp(header->magic, CompiledMagic, sizeof(header->magic)) != 0
+        || header->version != CompiledVersion
+        || header->source_hash != source_hash
+        || header->width == 0 || header->width >= INT16_MAX
+        || header->stride != header->width + 1
+        || header->height >= INT16_MAX
+        || header->nrooms > INT_MAX) {
+        return NULL;
+    }
+    uint64_t cells_size = (uint64_t)header->height * header->stride;
+    uint64_t rooms_size = header->nrooms * sizeof(int);
+    if (header->cells_offset > size || cells_size > size - header->cells_offset
+        || header->classes_offset > size || 256 > size - header->classes_offset
+        || header->cell_class_offset > size || cells_size > size - header->cell_class_offset
+        || header->rooms_offset > size || rooms_size > size - header->rooms_offset
+        || header->visibility_offset > size
+        || header->visibility_size > size - header->visibility_offset
+        || header->rooms_offset % sizeof(int) != 0
+        || memcmp(data + header->classes_offset, CellClass, 256) != 0) {
+        return NULL;
+    }
+    const unsigned char* cells = (unsigned char*)data + header->cells_offset;
+    const unsigned char* cell_class = (unsigned char*)data + header->cell_class_offset;
+    const int* rooms = (int*)(data + header->rooms_offset);
+    uint64_t nrooms = 0;
+    for (uint64_t i = 0; i < cells_size; i++) {
+        bool end_of_row = i % header->stride == header->width;
+        if ((cells[i] == '\0') != end_of_row || cell_class[i] != CellClass[cells[i]]
+            || (!end_of_row && cell_class[i] == 0)) {
+            return NULL;
+        }
+        if (cell_class[i] & GridRoom) {
+            if (nrooms == header->nrooms || rooms[nrooms] != (int)i) {
+                return NULL;
             }
-            mem_free(gold_map);
-            exit(1);
+            nrooms++;
+        }
+    }
+    if (nrooms != header->nrooms) {
+        return NULL;
+    }
+
+    // the grid's layers point straight into the file
+    grid_t* grid = mem_malloc_assert(sizeof(grid_t), "grid");
+    grid->height = header->height;
+    grid->width = header->width;
+    grid->stride = header->stride;
+    grid->cells = data + header->cells_offset;
+    grid->main_grid = mem_malloc_assert((grid->height + 1) * sizeof(char*), "grid rows");
+    for (int i = 0; i < grid->height; i++) {
+        grid->main_grid[i] = grid->cells + i * grid->stride;
+    }
+    grid->gold = NULL;
+    grid->gold_bits = NULL;
+    grid->base = NULL;
+    grid->overlay = NULL;
+    grid->classes = (unsigned char*)data + header->classes_offset;
+    grid->cell_class = (unsigned char*)data + header->cell_class_offset;
+    grid->rooms = (int*)(data + header->rooms_offset);
+    grid->nrooms = header->nrooms;
+    grid->free_cells = NULL;
+    grid->nfree = 0;
+    grid->free_where = NULL;
+    grid->visibility = header->visibility_size > 0 ? data + header->visibility_offset : NULL;
+    grid->visibility_size = header->visibility_size;
+    grid->mapping = data;
+    grid->mapping_size = size;
+    return grid;
+}
+
+/**************** write_section ****************/
+/* Writes size bytes of data at the next 8-byte boundary of fp,
+ * storing where it starts in *offset. Returns false on error.
+ */
+static bool
+write_section(FILE* fp, const void* data, size_t size, uint64_t* offset)
+{
+    long at = ftell(fp);
+    if (at < 0) {
+        return false;
+    }
+    while (at % 8 != 0) {
+        if (fputc('\0', fp) == EOF) {
+            return false;
+        }
+        at++;
+    }
+    *offset = at;
+    return size == 0 || fwrite(data, size, 1, fp) == 1;
+}
+
+/**************** grid_parse ****************/
+/* Builds a grid from the size bytes of map text at data, in two
+ * passes: one to measure the rows, one to copy them. Rows may end
+ * in "\r\n", blank lines after the last row are dropped, and rows
+ * shorter than the widest are padded with blanks. Prints an error
+ * naming mapFile and returns NULL if a row holds a symbol that is
+ * not a map symbol, or the map is empty or too large.
+ */
+static grid_t*
+grid_parse(const char* data, size_t size, const char* mapFile)
+{
+    // measure: the widest row gives the width, the last row that
+    // is not blank the height
+    const char* end = data + size;
+    size_t grid_width = 0;
+    size_t lines = 0;
+    size_t grid_height = 0;
+    for (const char* line = data; line < end; lines++) {
+        const char* newline = memchr(line, '\n', end - line);
+        const char* line_end = (newline == NULL) ? end : newline;
+        size_t length = line_end - line;
+        if (length > 0 && line[length - 1] == '\r') {
+            length--;
         }
-        // Initialize all elements in the current row to 0
-        for (int j = 0; j < grid_width; j++) {
-            gold_map[i][j] = 0;
+        if (length > 0) {
+            grid_height = lines + 1;
+            grid_width = length > grid_width ? length : grid_width;
         }
+        line = line_end + 1;
+    }
+    if (grid_width == 0) {
+        fprintf(stderr, "Error: %s is an empty map\n", mapFile);
+        return NULL;
+    }
+    // positions hold 16-bit coordinates
+    if (grid_width >= INT16_MAX || grid_height >= INT16_MAX) {
+        fprintf(stderr, "Error: %s is too large a map\n", mapFile);
+        return NULL;
+    }
+    int width = grid_width;
+    int height = grid_height;
+    grid_t* grid = grid_alloc(width, height);
+
+    // copy row by row, padding short rows and checking the symbols
+    const char* line = data;
+    for (int row = 0; row < height; row++) {
+        const char* newline = memchr(line, '\n', end - line);
+        const char* line_end = (newline == NULL) ? end : newline;
+        int length = line_end - line;
+        if (length > 0 && line[length - 1] == '\r') {
+            length--;
+        }
+        char* cell = grid->cells + row * grid->stride;
+        unsigned char* cell_class = grid->cell_class + row * grid->stride;
+        bool legal = true;
+        for (int col = 0; col < width; col++) {
+            unsigned char symbol = (col < length) ? line[col] : ' ';
+            cell[col] = symbol;
+            cell_class[col] = CellClass[symbol];
+            legal &= cell_class[col] != 0;
+        }
+        if (!legal) {
+            fprintf(stderr, "Error: %s row %d has a symbol that is not a map symbol\n",
+                    mapFile, row);
+            grid_delete(grid);
+            return NULL;
+        }
+        line = line_end + 1;
     }
-    grid->gold_grid = gold_map;
     return grid;
 }
 
+/**************** grid_new_layer ****************/
+/* see grid.h for description */
+grid_t*
+grid_new_layer(grid_t* base)
+{
+    if (base == NULL || base->base != NULL)
+    {
+        return NULL;
+    }
+    grid_t* grid = mem_malloc_assert(sizeof(grid_t), "grid");
+    grid->height = base->height;
+    grid->width = base->width;
+    grid->stride = base->stride;
+    grid->cells = base->cells;
+    grid->main_grid = base->main_grid;
+    grid->gold = NULL;
+    grid->gold_bits = NULL;
+    grid->base = base;
+    grid->overlay = intmap_new(64);
+    grid->classes = base->classes;
+    grid->cell_class = base->cell_class;
+    grid->rooms = NULL;
+    grid->nrooms = 0;
+    grid->visibility = NULL;
+    grid->visibility_size = 0;
+    grid->mapping = NULL;
+    grid->mapping_size = 0;
+
+    // every room cell of the base starts out free
+    int nrooms;
+    const int* rooms = grid_get_rooms(base, &nrooms);
+    grid->free_cells = mem_malloc_assert(nrooms * sizeof(int) + 1, "grid free cells");
+    grid->free_where = mem_malloc_assert((size_t)base->height * base->stride * sizeof(int) + 1,
+                                         "grid free cells");
+    memcpy(grid->free_cells, rooms, nrooms * sizeof(int));
+    for (int i = 0; i < nrooms; i++) {
+        grid->free_where[rooms[i]] = i;
+    }
+    grid->nfree = nrooms;
+    return grid;
+}
+
+/**************** grid_random_free ****************/
+/* see grid.h for description */
+bool
+grid_random_free(grid_t* grid, int* x, int* y)
+{
+    if (grid == NULL || grid->nfree == 0) {
+        return false;
+    }
+    int index = grid->free_cells[rand() % grid->nfree];
+    *x = index % grid->stride;
+    *y = index / grid->stride;
+    return true;
+}
+
+/**************** grid_count_free ****************/
+/* see grid.h for description */
+int
+grid_count_free(grid_t* grid)
+{
+    return (grid == NULL) ? 0 : grid->nfree;
+}
+
+/**************** update_free ****************/
+/* Keeps a layer's free cell index up to date as spot index
+ * takes symbol c: a room cell is free exactly when it shows '.'.
+ * Takes constant time, as free_where is indexed by spot.
+ */
+static void
+update_free(grid_t* grid, int index, char c)
+{
+    if (!(grid->cell_class[index] & GridRoom)) {
+        return;
+    }
+    int* where = &grid->free_where[index];
+    if (c == '.' && *where < 0) {
+        // add it at the end
+        *where = grid->nfree;
+        grid->free_cells[grid->nfree++] = index;
+    } else if (c != '.' && *where >= 0) {
+        // move the last free cell into its place
+        int last = grid->free_cells[--grid->nfree];
+        grid->free_cells[*where] = last;
+        grid->free_where[last] = *where;
+        *where = -1;
+    }
+}
+
 /**************** grid_get_symbol ****************/
 /* see grid.h for description */
 char
-grid_get_symbol(grid_t* grid, pos_t* pos)
+grid_get_symbol(grid_t* grid, pos_t pos)
 {
-    if (grid == NULL || pos == NULL)
+    if (grid == NULL)
     {
         return '\0';
     }
@@ -124,17 +609,58 @@ grid_get_symbol(grid_t* grid, pos_t* pos)
     {
         return '\0';
     }
-    int x_cord = (int)(get_position_x(pos));
-    int y_cord = (int)(get_position_y(pos));
-    return grid->main_grid[y_cord][x_cord];
+    int x_cord = get_position_x(pos);
+    int y_cord = get_position_y(pos);
+    return grid_get_symbol_at(grid, x_cord, y_cord);
+}
+
+/**************** grid_get_symbol_at ****************/
+/* see grid.h for description */
+char
+grid_get_symbol_at(grid_t* grid, int x, int y)
+{
+    if (grid == NULL || x < 0 || y < 0 || x >= grid->width || y >= grid->height)
+    {
+        return '\0';
+    }
+    int index = y * grid->stride + x;
+    int symbol;
+    if (grid->overlay != NULL && intmap_find(grid->overlay, index, &symbol))
+    {
+        return symbol;
+    }
+    return grid->cells[index];
+}
+
+/**************** grid_set_symbol_at ****************/
+/* see grid.h for description */
+void
+grid_set_symbol_at(grid_t* grid, int x, int y, char c)
+{
+    if (grid == NULL || x < 0 || y < 0 || x >= grid->width || y >= grid->height)
+    {
+        return;
+    }
+    int index = y * grid->stride + x;
+    if (grid->overlay == NULL) {
+        grid->cells[index] = c;
+        grid->cell_class[index] = grid->classes[(unsigned char)c];
+    } else {
+        if (grid->cells[index] == c) {
+            intmap_remove(grid->overlay, index);    // back to the terrain
+        } else {
+            intmap_set(grid->overlay, index, c);
+        }
+        update_free(grid, index, c);
+    }
 }
 
 /**************** grid_get_gold ****************/
 /* see grid.h for description */
 int 
-grid_get_gold(grid_t* grid, pos_t* pos)
+grid_get_gold(grid_t* grid, pos_t pos)
 {
-    if (grid == NULL || pos == NULL)
+    if (grid == NULL)
     {
         return 0;
     }
@@ -142,9 +668,27 @@ grid_get_gold(grid_t* grid, pos_t* pos)
     {
         return 0;
     }
-    int x_cord = (int)(get_position_x(pos));
-    int y_cord = (int)(get_position_y(pos));
-    return grid->gold_grid[y_cord][x_cord];
+    int x_cord = get_position_x(pos);
+    int y_cord = get_position_y(pos);
+    return grid_get_gold_at(grid, x_cord, y_cord);
+}
+
+/**************** grid_get_gold_at ****************/
+/* see grid.h for description */
+int
+grid_get_gold_at(grid_t* grid, int x, int y)
+{
+    if (grid == NULL || grid->gold == NULL
+        || x < 0 || y < 0 || x >= grid->width || y >= grid->height)
+    {
+        return 0;
+    }
+    int index = y * grid->stride + x;
+    int n = 0;
+    if ((grid->gold_bits[index / 8] >> (index % 8)) & 1) {
+        intmap_find(grid->gold, index, &n);
+    }
+    return n;
 }
 
 /**************** grid_get_width ****************/
@@ -171,6 +715,98 @@ grid_get_height(grid_t* grid)
     return grid->height+1;
 }
 
+/**************** grid_get_stride ****************/
+/* see grid.h for description */
+int
+grid_get_stride(grid_t* grid)
+{
+    if (grid == NULL)
+    {
+        return 0;
+    }
+    return grid->stride;
+}
+
+/**************** grid_get_class_at ****************/
+/* see grid.h for description */
+int
+grid_get_class_at(grid_t* grid, int x, int y)
+{
+    if (grid == NULL || x < 0 || y < 0 || x >= grid->width || y >= grid->height)
+    {
+        return 0;
+    }
+    return grid->cell_class[y * grid->stride + x];
+}
+
+/**************** grid_get_rooms ****************/
+/* see grid.h for description */
+const int*
+grid_get_rooms(grid_t* grid, int* count)
+{
+    if (grid == NULL) {
+        *count = 0;
+        return NULL;
+    }
+    if (grid->base != NULL) {
+        return grid_get_rooms(grid->base, count);
+    }
+    if (grid->rooms == NULL) {
+        // list the room cells the first time they are asked for
+        int n = 0;
+        for (int i = 0; i < grid->height * grid->stride; i++) {
+            n += (grid->cell_class[i] & GridRoom) != 0;
+        }
+        grid->rooms = mem_malloc_assert(n * sizeof(int) + 1, "grid rooms");
+        n = 0;
+        for (int i = 0; i < grid->height * grid->stride; i++) {
+            if (grid->cell_class[i] & GridRoom) {
+                grid->rooms[n++] = i;
+            }
+        }
+        grid->nrooms = n;
+    }
+    *count = grid->nrooms;
+    return grid->rooms;
+}
+
+/**************** grid_get_visibility_data ****************/
+/* see grid.h for description */
+const void*
+grid_get_visibility_data(grid_t* grid, size_t* size)
+{
+    if (grid == NULL || grid->visibility == NULL) {
+        *size = 0;
+        return NULL;
+    }
+    *size = grid->visibility_size;
+    return grid->visibility;
+}
+
+/**************** grid_get_base ****************/
+/* see grid.h for description */
+grid_t*
+grid_get_base(grid_t* grid)
+{
+    if (grid == NULL)
+    {
+        return NULL;
+    }
+    return grid->base;
+}
+
+/**************** grid_get_cells ****************/
+/* see grid.h for description */
+char*
+grid_get_cells(grid_t* grid)
+{
+    if (grid == NULL)
+    {
+        return NULL;
+    }
+    return grid->cells;
+}
+
 /**************** get_main_grid ****************/
 /* see grid.h for description */
 char** 
@@ -183,16 +819,33 @@ get_main_grid(grid_t* grid)
     return grid->main_grid;
 }
 
-/**************** get_gold_grid ****************/
+/**************** grid_compose ****************/
 /* see grid.h for description */
-int** 
-get_gold_grid(grid_t* grid)
+void
+grid_compose(grid_t* grid, char* dest, int dest_stride)
 {
-    if (grid == NULL)
-    {
-        return 0; 
+    if (grid == NULL || dest == NULL || dest_stride < grid->width) {
+        return;
+    }
+    // copy the terrain row by row; grid_parse padded short rows
+    for (int i = 0; i < grid->height; i++) {
+        memcpy(dest + i * dest_stride, grid->cells + i * grid->stride, grid->width);
     }
-    return grid->gold_grid;
+    // then whatever the overlay has placed on top
+    compose_t compose = { dest, dest_stride, grid->stride };
+    intmap_iterate(grid->overlay, &compose, compose_overlay);
+}
+
+/**************** compose_overlay ****************/
+/* Writes one overlay symbol into a grid_compose destination.
+ */
+static void
+compose_overlay(void* arg, uint64_t key, int value)
+{
+    compose_t* compose = arg;
+    int x = (int)(key % compose->stride);
+    int y = (int)(key / compose->stride);
+    compose->dest[y * compose->dest_stride + x] = value;
 }
 
 /**************** grid_print ****************/
@@ -205,7 +858,7 @@ grid_print(grid_t* grid)
     }
     for (int i = 0; i < grid->height; i++) {
         for (int j = 0; j < grid->width; j++) {
-            printf("%c", grid->main_grid[i][j]);
+            printf("%c", grid_get_symbol_at(grid, j, i));
         }
         printf("\n");
     }
@@ -220,20 +873,27 @@ grid_delete(grid_t* grid)
         return; // bad grid
     }
 
-    // Free the main grid memory
-    if (grid->main_grid != NULL) {
-        for (int i = 0; i < grid->height; i++) {
-        mem_free(grid->main_grid[i]);
-        }
+    // Free the cell buffers and their row views; a layer
+    // only owns its overlay, and a compiled grid's cells
+    // and rooms are in its mapped file
+    if (grid->base != NULL) {
+        intmap_delete(grid->overlay);
+        mem_free(grid->free_cells);
+        mem_free(grid->free_where);
+    } else if (grid->mapping != NULL) {
+        munmap(grid->mapping, grid->mapping_size);
         mem_free(grid->main_grid);
-    }
-
-    // Free the gold grid memory
-    if (grid->gold_grid != NULL) {
-        for (int i = 0; i < grid->height; i++) {
-        mem_free(grid->gold_grid[i]);
+    } else {
+        mem_free(grid->cells);
+        mem_free(grid->cell_class);
+        mem_free(grid->main_grid);
+        if (grid->rooms != NULL) {
+            mem_free(grid->rooms);
         }
-        mem_free(grid->gold_grid);
+    }
+    if (grid->gold != NULL) {
+        intmap_delete(grid->gold);
+        mem_free(grid->gold_bits);
     }
     // Free the grid structure
     mem_free(grid);
@@ -242,9 +902,9 @@ grid_delete(grid_t* grid)
 /**************** grid_set_symbol ****************/
 /* see grid.h for description */
 void 
-grid_set_symbol(grid_t* grid, pos_t* pos, char c)
+grid_set_symbol(grid_t* grid, pos_t pos, char c)
 {
-    if (grid == NULL || pos == NULL)
+    if (grid == NULL)
     {
         return;
     }
@@ -252,15 +912,15 @@ grid_set_symbol(grid_t* grid, pos_t* pos, char c)
     {
         return;
     }
-    int x_cord = (int)(get_position_x(pos));
-    int y_cord = (int)(get_position_y(pos));
-    grid->main_grid[y_cord][x_cord] = c;
+    int x_cord = get_position_x(pos);
+    int y_cord = get_position_y(pos);
+    grid_set_symbol_at(grid, x_cord, y_cord, c);
 }
 
 /**************** grid_remove_gold ****************/
 /* see grid.h for description */
 void 
-grid_remove_gold(grid_t* grid, pos_t* pos)
+grid_remove_gold(grid_t* grid, pos_t pos)
 {
     grid_set_gold(grid, pos, 0);
 }
@@ -268,9 +928,9 @@ grid_remove_gold(grid_t* grid, pos_t* pos)
 /**************** grid_set_gold ****************/
 /* see grid.h for description */
 void 
-grid_set_gold(grid_t* grid, pos_t* pos, int n)
+grid_set_gold(grid_t* grid, pos_t pos, int n)
 {
-    if (grid == NULL || pos == NULL || n < 0)
+    if (grid == NULL || n < 0)
     {
         return;
     }
@@ -278,23 +938,52 @@ grid_set_gold(grid_t* grid, pos_t* pos, int n)
     {
         return;
     }
-    int x_cord = (int)(get_position_x(pos));
-    int y_cord = (int)(get_position_y(pos));
-    grid->gold_grid[y_cord][x_cord] = n;
+    int x_cord = get_position_x(pos);
+    int y_cord = get_position_y(pos);
+    grid_set_gold_at(grid, x_cord, y_cord, n);
+}
+
+/**************** grid_set_gold_at ****************/
+/* see grid.h for description */
+void
+grid_set_gold_at(grid_t* grid, int x, int y, int n)
+{
+    if (grid == NULL || n < 0
+        || x < 0 || y < 0 || x >= grid->width || y >= grid->height)
+    {
+        return;
+    }
+    if (grid->gold == NULL) {
+        if (n == 0) {
+            return;
+        }
+        // first gold placed: allocate the store, empty
+        grid->gold = intmap_new(32);
+        grid->gold_bits = mem_calloc_assert(((size_t)grid->height * grid->stride + 7) / 8, 1,
+                                            "grid gold bits");
+    }
+    int index = y * grid->stride + x;
+    if (n == 0) {
+        intmap_remove(grid->gold, index);
+        grid->gold_bits[index / 8] &= ~(1 << (index % 8));
+    } else {
+        intmap_set(grid->gold, index, n);
+        grid->gold_bits[index / 8] |= 1 << (index % 8);
+    }
 }
 
 /**************** grid_is_inside ****************/
 /* see grid.h for description */
 bool 
-grid_is_inside(grid_t* grid, pos_t* pos)
+grid_is_inside(grid_t* grid, pos_t pos)
 {
 
-    if (grid == NULL || pos == NULL)
+    if (grid == NULL)
     {
         return false; 
     }
-    int x_cord = (int)(get_position_x(pos));
-    int y_cord = (int)(get_position_y(pos));
+    int x_cord = get_position_x(pos);
+    int y_cord = get_position_y(pos);
     if (x_cord >= grid->width || y_cord >= grid->height || x_cord < 0 || y_cord < 0) {
         // bad position coordinates  
         return false;
@@ -339,57 +1028,47 @@ grid_new_blank_array(int width, int height)
 grid_t* 
 make_grid_blank(int width, int height)
 {
-    grid_t* blankgrid = mem_malloc(sizeof(grid_t));
-    blankgrid->main_grid = grid_new_blank_array(width, height);
-    blankgrid->gold_grid = NULL;
-    blankgrid->height = height;
-    blankgrid->width = width;
-
-    int row = 0;
-    int col = 0;
-    char ch = ' ';
-    while (row < height) {
-    // Check for newline to move to the next row
-        if (col == width) {
-            // Null-terminate the current line
-            blankgrid->main_grid[row][col] = '\0';  
-            row++;
-            col = 0;
-        } 
-        else {
-            if (col < width) {
-                blankgrid->main_grid[row][col] = ch;
-                col++;
-            }
-        }
+    if (width < 0 || height < 0) {
+        return NULL;
+    }
+    grid_t* blankgrid = grid_alloc(width, height);
+    for (int row = 0; row < height; row++) {
+        memset(blankgrid->cells + row * blankgrid->stride, ' ', width);
+        memset(blankgrid->cell_class + row * blankgrid->stride, GridSolid, width);
     }
-  return blankgrid;
+    return blankgrid;
 }
 
 /**************** grid_valid_position ****************/
 /* see grid.h for description */
 bool
-grid_valid_position(grid_t* grid, pos_t* pos)
+grid_valid_position(grid_t* grid, pos_t pos)
 {
-  if (grid_is_inside(grid, pos)) {
-    char symbol = grid_get_symbol(grid, pos);
-    if (symbol == '-' || symbol == '+'  || symbol == ' ' || symbol == '|') {
-      return false;
-    }
+  if (!grid_is_inside(grid, pos)) {
+    return false;
   }
-  return true;
+  int x = get_position_x(pos);
+  int y = get_position_y(pos);
+  return (grid->cell_class[y * grid->stride + x] & GridWalkable) != 0;
 }
 
 /**************** grid_in_room ****************/
 /* see grid.h for description */
 bool
-grid_in_room(grid_t* grid, pos_t* pos)
+grid_in_room(grid_t* grid, pos_t pos)
 {
-  if (grid_is_inside(grid, pos)) {
-    char symbol = grid_get_symbol(grid, pos);
-    if (isupper(symbol) || symbol == '.' || symbol == '*') {
-      return true;
-    }
+  if (!grid_is_inside(grid, pos)) {
+    return false;
   }
-  return false;
-}
\ No newline at end of file
+  int x = get_position_x(pos);
+  int y = get_position_y(pos);
+  return (grid->cell_class[y * grid->stride + x] & GridRoom) != 0;
+}
+
+/**************** grid_in_room_at ****************/
+/* see grid.h for description */
+bool
+grid_in_room_at(grid_t* grid, int x, int y)
+{
+  return (grid_get_class_at(grid, x, y) & GridRoom) != 0;
+}
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "../libcs50/file.h"
 #include "../libcs50/mem.h"
 #include "../structures/structures.h"
@@ -17,21 +18,95 @@
 /**************** global types ****************/
 typedef struct grid grid_t;     // opaque to users of the module
 
+/**************** cell classes ****************/
+/* What a terrain symbol is; see grid_get_class_at. */
+#define GridRoom      0x01      // '.'  room floor
+#define GridPassage   0x02      // '#'  passage
+#define GridWall      0x04      // '-', '|', '+'  room boundary
+#define GridSolid     0x08      // ' '  solid rock
+#define GridWalkable  (GridRoom | GridPassage)
+
 /**************** functions ****************/
 
 /**************** grid_new ****************/
 /* Creates a new grid based on a map file provided as input.
- * Reads the map file to determine the dimensions, allocates memory for
- * the 2D array representation of the map and initializes the gold grid.
+ * Maps the file into memory and parses it in two passes: the first
+ * measures the rows, since short and ragged rows mean neither the
+ * first row nor the file size gives the width and height; the second
+ * copies them into the grid.
+ * Rows hold only map symbols (' ', '-', '|', '+', '.', '#'), and may
+ * end in "\r\n"; rows shorter than the widest are padded with blanks,
+ * and blank lines at the end are dropped. The map must be under 32767
+ * spots each way. Returns NULL, with a message on
+ * stderr, if the file cannot be read or is not such a map.
  */
 grid_t* grid_new(char* mapFile);
 
+/**************** grid_load_compiled ****************/
+/* Loads mapFile through its compiled form (see mapc): maps the
+ * compiled file into memory and uses its cells, room list and
+ * visibility data in place, without parsing or precomputing.
+ * Falls back to grid_new on mapFile, with a note on stderr, if the
+ * compiled file is stale (compiled from a different mapFile, by a
+ * different build) or damaged, and silently if it is missing.
+ * Returns NULL if mapFile itself cannot be read.
+ */
+grid_t* grid_load_compiled(char* compiledFile, char* mapFile);
+
+/**************** grid_write_compiled ****************/
+/* Writes the compiled form of grid, loaded from mapFile, to
+ * compiledFile: the cells, the cell class table, the room list and
+ * the given visibility data (see visibility_pack), keyed by a hash
+ * of mapFile. Returns false, with a message on stderr, on error.
+ */
+bool grid_write_compiled(grid_t* grid, char* mapFile, char* compiledFile,
+                         const void* visibility, size_t visibility_size);
+
+/**************** grid_compiled_name ****************/
+/* Returns the usual name of mapFile's compiled form: its name with
+ * ".txt" replaced by (or ".mapc" added). The caller must free it.
+ */
+char* grid_compiled_name(char* mapFile);
+
+/**************** grid_new_layer ****************/
+/* Creates a layered grid over base: it reads as a copy of base,
+ * but shares base's terrain and keeps only the symbols set on it
+ * since (players, gold) in a sparse overlay. Setting a spot back
+ * to its base symbol drops it from the overlay. Gold is the
+ * layer's own. base must outlive the layer and must not change.
+ * Returns NULL if base is NULL or is itself a layer.
+ */
+grid_t* grid_new_layer(grid_t* base);
+
+/**************** grid_random_free ****************/
+/* Picks a free cell of a layer (a room cell showing '.', with
+ * no player or gold on it) uniformly at random, storing its
+ * column and row in *x and *y. The layer keeps its free cells
+ * indexed as symbols are set, so this takes constant time.
+ * Returns false if there is no free cell, or grid is not a layer.
+ */
+bool grid_random_free(grid_t* grid, int* x, int* y);
+
+/**************** grid_count_free ****************/
+/* Returns the number of free cells of a layer, or 0 if grid
+ * is not a layer.
+ */
+int grid_count_free(grid_t* grid);
+
 /**************** grid_delete ****************/
 /* Frees the memory associated with the grid.
- * Releases memory for both the main grid and the gold grid.
+ * Releases memory for both the main grid and the gold grid;
+ * a layer leaves its base's terrain alone.
  */
 void grid_delete(grid_t* grid);
 
+/**************** grid_compose ****************/
+/* Writes the grid's symbols, base and overlay together, into dest:
+ * row y goes to dest + y * dest_stride, width symbols. Nothing else
+ * in dest is touched.
+ */
+void grid_compose(grid_t* grid, char* dest, int dest_stride);
+
 /**************** grid_print ****************/
 /* Prints the grid to standard output.
  * Outputs each row of the main grid, line by line.
@@ -43,13 +118,29 @@ void grid_print(grid_t* grid);
  * Returns the character located at the given position, or '\0' if
  * the position is invalid or outside the grid boundaries.
  */
-char grid_get_symbol(grid_t* grid, pos_t* pos);
+char grid_get_symbol(grid_t* grid, pos_t pos);
+
+/**************** grid_get_symbol_at ****************/
+/* Same as grid_get_symbol, for integer column x and row y.
+ */
+char grid_get_symbol_at(grid_t* grid, int x, int y);
+
+/**************** grid_set_symbol_at ****************/
+/* Same as grid_set_symbol, for integer column x and row y.
+ */
+void grid_set_symbol_at(grid_t* grid, int x, int y, char c);
 
 /**************** grid_get_gold ****************/
 /* Retrieves the amount of gold at a specified position in the grid.
  * Returns the number of gold nuggets at the position or 0 if the position is invalid.
  */
-int grid_get_gold(grid_t* grid, pos_t* pos);
+int grid_get_gold(grid_t* grid, pos_t pos);
+
+/**************** grid_get_gold_at ****************/
+/* Same as grid_get_gold, for integer column x and row y.
+ * Spots without gold cost one bit test.
+ */
+int grid_get_gold_at(grid_t* grid, int x, int y);
 
 /**************** grid_get_width ****************/
 /* Retrieves the width of the grid.
@@ -63,40 +154,83 @@ int grid_get_width(grid_t* grid);
  */
 int grid_get_height(grid_t* grid);
 
+/**************** grid_get_stride ****************/
+/* Retrieves the distance between the starts of two rows
+ * in the cell buffer; symbol (x, y) is at y * stride + x.
+ * Returns 0 if the grid is invalid.
+ */
+int grid_get_stride(grid_t* grid);
+
+/**************** grid_get_class_at ****************/
+/* Retrieves the cell class (GridRoom, ...) of the terrain at
+ * column x and row y, ignoring anything placed on a layer. The
+ * classes are kept per spot from load time, so this is one load.
+ * Returns 0 if the spot is outside the grid.
+ */
+int grid_get_class_at(grid_t* grid, int x, int y);
+
+/**************** grid_get_rooms ****************/
+/* Retrieves the room cells of the terrain, as spot indices
+ * y * stride + x (see grid_get_stride), storing how many in *count.
+ * The list belongs to the grid.
+ */
+const int* grid_get_rooms(grid_t* grid, int* count);
+
+/**************** grid_get_visibility_data ****************/
+/* Retrieves the visibility data a compiled grid was loaded with,
+ * storing its size in *size, or NULL if there is none.
+ */
+const void* grid_get_visibility_data(grid_t* grid, size_t* size);
+
+/**************** grid_get_base ****************/
+/* Retrieves the base a layered grid was made over, or NULL
+ * if the grid is not a layer.
+ */
+grid_t* grid_get_base(grid_t* grid);
+
+/**************** grid_get_cells ****************/
+/* Retrieves the grid's contiguous, row-major cell buffer.
+ * Each row is null-terminated. For a layer this is the base's
+ * terrain, without the overlay (see grid_compose).
+ * Returns NULL if the grid is invalid.
+ */
+char* grid_get_cells(grid_t* grid);
+
 /**************** get_main_grid ****************/
-/* Retrieves the main 2D character array of the grid.
+/* Retrieves the main 2D character array of the grid, as row
+ * pointers into the cell buffer (see grid_get_cells), so for a
+ * layer it shows the terrain only.
  * Returns a pointer to the main grid array or NULL if the grid is invalid.
  */
 char** get_main_grid(grid_t* grid);
 
-/**************** get_gold_grid ****************/
-/* Retrieves the gold grid (2D array of integers) of the grid.
- * Returns a pointer to the gold grid array or NULL if the grid is invalid.
- */
-int** get_gold_grid(grid_t* grid);
-
 /**************** grid_is_inside ****************/
 /* Checks if a position is inside the grid boundaries.
  * Returns true if the position is valid; otherwise, returns false.
  */
-bool grid_is_inside(grid_t* grid, pos_t* pos);
+bool grid_is_inside(grid_t* grid, pos_t pos);
 
 /**************** grid_set_symbol ****************/
 /* Sets a specific symbol at a given position in the grid.
  * Does nothing if the position is outside the grid boundaries or if the input is invalid.
  */
-void grid_set_symbol(grid_t* grid, pos_t* pos, char c);
+void grid_set_symbol(grid_t* grid, pos_t pos, char c);
 
 /**************** grid_set_gold ****************/
 /* Sets the amount of gold at a specific position in the grid.
  * Does nothing if the input is invalid or if the amount is negative.
  */
-void grid_set_gold(grid_t* grid, pos_t* pos, int n);
+void grid_set_gold(grid_t* grid, pos_t pos, int n);
+
+/**************** grid_set_gold_at ****************/
+/* Same as grid_set_gold, for integer column x and row y.
+ */
+void grid_set_gold_at(grid_t* grid, int x, int y, int n);
 
 /**************** grid_remove_gold ****************/
 /* Removes gold from the specified position by setting its value to 0.
  */
-void grid_remove_gold(grid_t* grid, pos_t* pos);
+void grid_remove_gold(grid_t* grid, pos_t pos);
 
 /**************** grid_new_blank_array ****************/
 /* Creates a new blank 2D array with the given width and height.
@@ -112,12 +246,19 @@ grid_t* make_grid_blank(int width, int height);
 
 /**************** grid_valid_position ****************/
 /* Checks if a position is valid for gameplay (i.e., not a wall or boundary).
- * Returns true if the position is valid; otherwise, returns false.
+ * Looks at the terrain's cell class, so players and gold do not matter.
+ * Returns true if the position is inside the grid and valid; otherwise, returns false.
  */
-bool grid_valid_position(grid_t* grid, pos_t* pos);
+bool grid_valid_position(grid_t* grid, pos_t pos);
 
 /**************** grid_in_room ****************/
-/* Checks if a position is within a room ('.', '*', or an uppercase letter).
- * Returns true if the position is inside a room; otherwise, returns false.
+/* Checks if a position is within a room: its terrain is room floor '.',
+ * whatever player or gold is on it. Returns true if the position is
+ * inside a room; otherwise, returns false.
+ */
+bool grid_in_room(grid_t* grid, pos_t pos);
+
+/**************** grid_in_room_at ****************/
+/* Same as grid_in_room, for integer column x and row y.
  */
-bool grid_in_room(grid_t* grid, pos_t* pos);
\ No newline at end of file
+bool grid_in_room_at(grid_t* grid, int x, int y);
\ No newline at end of file
@@ -23,5 +23,26 @@ main(const int argc, char* argv[])
     //    }
     //    printf("\n");
     //}
+
+    // a layer reads like its base until something is placed on it
+    grid_t* layer = grid_new_layer(grid);
+    grid_set_symbol_at(layer, 3, 1, 'A');
+    grid_set_symbol_at(layer, 4, 1, '*');
+    grid_set_symbol_at(layer, 4, 1, '.');
+    printf("layer (3,1) '%c', (4,1) '%c'; base (3,1) '%c'\n",
+           grid_get_symbol_at(layer, 3, 1), grid_get_symbol_at(layer, 4, 1),
+           grid_get_symbol_at(grid, 3, 1));
+    grid_print(layer);
+
+    // the layer's free cells follow what is placed on it
+    int x, y;
+    printf("free cells: %d\n", grid_count_free(layer));
+    grid_set_symbol_at(layer, 3, 1, '.');
+    printf("free cells after moving A off: %d\n", grid_count_free(layer));
+    while (grid_random_free(layer, &x, &y)) {
+        grid_set_symbol_at(layer, x, y, '*');
+    }
+    printf("free cells after filling every one: %d\n", grid_count_free(layer));
+    grid_delete(layer);
     grid_delete(grid);
 }
\ No newline at end of file
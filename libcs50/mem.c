@@ -8,18 +8,65 @@
  * 2. Variants that 'assert' the result is non-NULL;
  *    if NULL occurs, kick out an error and die.
  *
+ * 3. Arenas and pools of fixed-size objects within them.
+ *
+ * Compile with -DUNIT_TEST for a standalone unit test; see below.
+ *
  * David Kotz, April 2016, 2017, 2019, 2021
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include "mem.h"
 
+/**************** local types ****************/
+typedef struct chunk {
+  struct chunk* next;     // chunks are kept, in order, across resets
+  size_t size;            // bytes available after the header
+} chunk_t;
+
+typedef struct freeobj {
+  struct freeobj* next;   // freed pool objects, threaded through themselves
+} freeobj_t;
+
+struct mem_pool {
+  const char* name;
+  size_t size;            // object size, rounded up for alignment
+  freeobj_t* free;        // objects ready for reuse
+  mem_arena_t* arena;     // where new objects come from
+  mem_pool_t* next;       // the arena's other pools
+  int live;               // objects handed out and not yet freed
+  int peak;               // most live at once
+  int allocs;             // mem_pool_alloc calls
+};
+
+struct mem_arena {
+  const char* name;
+  size_t chunk_size;      // size of the chunks taken from malloc
+  chunk_t* first;         // all chunks
+  chunk_t* current;       // the chunk being bumped through
+  size_t offset;          // bytes used in current
+  size_t used;            // bytes handed out since the last reset
+  size_t peak;            // most bytes handed out between resets
+  int nchunks;
+  mem_pool_t* pools;      // pools created since the last reset
+  mem_arena_t* next;      // the other live arenas, for mem_report
+};
+
 /**************** file-local global variables ****************/
 // track malloc and free across *all* calls within this program.
 static int nmalloc = 0;         // number of successful malloc calls
 static int nfree = 0;           // number of free calls
 static int nfreenull = 0;       // number of free(NULL) calls
+static mem_arena_t* arenas = NULL;  // live arenas, for mem_report
+
+/**************** file-local constants ****************/
+// arena allocations are rounded to this, so chunk headers are too
+static const size_t Align = _Alignof(max_align_t);
+
+/**************** local functions ****************/
+static size_t align_up(size_t size);
 
 
 /**************** mem_assert ****************/
@@ -116,6 +163,14 @@ mem_report(FILE* fp, const char* message)
 {
   fprintf(fp, "%s: %d malloc, %d free, %d free(NULL), %d net\n", 
           message, nmalloc, nfree, nfreenull, nmalloc - nfree - nfreenull);
+  for (mem_arena_t* arena = arenas; arena != NULL; arena = arena->next) {
+    fprintf(fp, "  arena %s: %zu bytes used, %zu peak, %d chunks\n",
+            arena->name, arena->used, arena->peak, arena->nchunks);
+    for (mem_pool_t* pool = arena->pools; pool != NULL; pool = pool->next) {
+      fprintf(fp, "    pool %s: %zu-byte objects, %d live, %d peak, %d allocs\n",
+              pool->name, pool->size, pool->live, pool->peak, pool->allocs);
+    }
+  }
 }
 
 /**************** mem_net() ****************/
@@ -125,3 +180,260 @@ mem_net(void)
 {
   return nmalloc - nfree - nfreenull;
 }
+
+/**************** mem_arena_new() ****************/
+/* see mem.h for description */
+mem_arena_t*
+mem_arena_new(const char* name, const size_t chunk_size)
+{
+  mem_arena_t* arena = mem_malloc_assert(sizeof(mem_arena_t), "mem_arena_new");
+  arena->name = name;
+  arena->chunk_size = align_up(chunk_size > 0 ? chunk_size : Align);
+  arena->first = NULL;
+  arena->current = NULL;
+  arena->offset = 0;
+  arena->used = 0;
+  arena->peak = 0;
+  arena->nchunks = 0;
+  arena->pools = NULL;
+  arena->next = arenas;
+  arenas = arena;
+  return arena;
+}
+
+/**************** mem_arena_alloc() ****************/
+/* see mem.h for description */
+void*
+mem_arena_alloc(mem_arena_t* arena, const size_t size)
+{
+  mem_assert(arena, "mem_arena_alloc");
+  size_t need = align_up(size > 0 ? size : 1);
+
+  // move on to the next kept chunk, or add one, if this one is full
+  while (arena->current == NULL || arena->offset + need > arena->current->size) {
+    chunk_t* next = arena->current == NULL ? arena->first : arena->current->next;
+    if (next == NULL || need > next->size) {
+      size_t chunk = need > arena->chunk_size ? need : arena->chunk_size;
+      chunk_t* fresh = mem_malloc_assert(align_up(sizeof(chunk_t)) + chunk, arena->name);
+      fresh->size = chunk;
+      fresh->next = next;
+      if (arena->current == NULL) {
+        arena->first = fresh;
+      } else {
+        arena->current->next = fresh;
+      }
+      next = fresh;
+      arena->nchunks++;
+    }
+    arena->current = next;
+    arena->offset = 0;
+  }
+
+  void* ptr = (char*)arena->current + align_up(sizeof(chunk_t)) + arena->offset;
+  arena->offset += need;
+  arena->used += need;
+  if (arena->used > arena->peak) {
+    arena->peak = arena->used;
+  }
+  return ptr;
+}
+
+/**************** mem_arena_reset() ****************/
+/* see mem.h for description */
+void
+mem_arena_reset(mem_arena_t* arena)
+{
+  if (arena != NULL) {
+    arena->current = arena->first;
+    arena->offset = 0;
+    arena->used = 0;
+    arena->pools = NULL;
+  }
+}
+
+/**************** mem_arena_delete() ****************/
+/* see mem.h for description */
+void
+mem_arena_delete(mem_arena_t* arena)
+{
+  if (arena == NULL) {
+    return;
+  }
+  for (mem_arena_t** link = &arenas; *link != NULL; link = &(*link)->next) {
+    if (*link == arena) {
+      *link = arena->next;
+      break;
+    }
+  }
+  chunk_t* chunk = arena->first;
+  while (chunk != NULL) {
+    chunk_t* next = chunk->next;
+    mem_free(chunk);
+    chunk = next;
+  }
+  mem_free(arena);
+}
+
+/**************** mem_pool_new() ****************/
+/* see mem.h for description */
+mem_pool_t*
+mem_pool_new(mem_arena_t* arena, const char* name, const size_t size)
+{
+  mem_pool_t* pool = mem_arena_alloc(arena, sizeof(mem_pool_t));
+  pool->name = name;
+  pool->size = align_up(size > sizeof(freeobj_t) ? size : sizeof(freeobj_t));
+  pool->free = NULL;
+  pool->arena = arena;
+  pool->live = 0;
+  pool->peak = 0;
+  pool->allocs = 0;
+  pool->next = arena->pools;
+  arena->pools = pool;
+  return pool;
+}
+
+/**************** mem_pool_alloc() ****************/
+/* see mem.h for description */
+void*
+mem_pool_alloc(mem_pool_t* pool)
+{
+  mem_assert(pool, "mem_pool_alloc");
+  void* ptr;
+  if (pool->free != NULL) {
+    ptr = pool->free;
+    pool->free = pool->free->next;
+  } else {
+    ptr = mem_arena_alloc(pool->arena, pool->size);
+  }
+  pool->allocs++;
+  if (++pool->live > pool->peak) {
+    pool->peak = pool->live;
+  }
+  return ptr;
+}
+
+/**************** mem_pool_free() ****************/
+/* see mem.h for description */
+void
+mem_pool_free(mem_pool_t* pool, void* ptr)
+{
+  if (pool != NULL && ptr != NULL) {
+    freeobj_t* obj = ptr;
+    obj->next = pool->free;
+    pool->free = obj;
+    pool->live--;
+  }
+}
+
+/**************** mem_pool_size() ****************/
+/* see mem.h for description */
+size_t
+mem_pool_size(mem_pool_t* pool)
+{
+  return pool == NULL ? 0 : pool->size;
+}
+
+/**************** align_up() ****************/
+/* Round size up to a multiple of Align. */
+static size_t
+align_up(size_t size)
+{
+  return (size + Align - 1) / Align * Align;
+}
+
+
+/* ****************************************************************** */
+/* ************************* UNIT_TEST ****************************** */
+/*
+ * This unit test exercises arenas and pools:
+ *   ./memtest
+ * It grows an arena across several chunks and past its chunk size,
+ * resets it and checks the same memory comes back without new chunks,
+ * frees and reuses pool objects, and checks deleting the arena
+ * returns every chunk to the heap.
+ * It exits with an assertion failure if anything is wrong.
+ */
+
+#ifdef UNIT_TEST
+
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+
+#define Objects 100          // allocations per round
+static const size_t ChunkSize = 256;
+
+int
+main(void)
+{
+  int baseline = mem_net();
+  mem_arena_t* arena = mem_arena_new("test arena", ChunkSize);
+  void* first[Objects];
+
+  // growth: small objects fill several chunks, each aligned and intact
+  for (int i = 0; i < Objects; i++) {
+    first[i] = mem_arena_alloc(arena, 24);
+    assert((uintptr_t)first[i] % Align == 0);
+    memset(first[i], i, 24);
+  }
+  for (int i = 0; i < Objects; i++) {
+    unsigned char* bytes = first[i];
+    assert(bytes[0] == i && bytes[23] == i);
+  }
+  assert(arena->nchunks > 1);
+  assert(arena->used == Objects * align_up(24));
+
+  // an object bigger than a chunk gets a chunk of its own
+  char* big = mem_arena_alloc(arena, 4 * ChunkSize);
+  memset(big, 'x', 4 * ChunkSize);
+  int nchunks = arena->nchunks;
+
+  // reset: the same requests get the same memory, with no new chunks
+  mem_arena_reset(arena);
+  assert(arena->used == 0);
+  for (int i = 0; i < Objects; i++) {
+    assert(mem_arena_alloc(arena, 24) == first[i]);
+  }
+  assert(mem_arena_alloc(arena, 4 * ChunkSize) == big);
+  assert(arena->nchunks == nchunks);
+  assert(arena->peak == Objects * align_up(24) + 4 * ChunkSize);
+
+  // pools: freed objects come back, most recent first
+  mem_arena_reset(arena);
+  mem_pool_t* pool = mem_pool_new(arena, "test pool", 1);
+  assert(mem_pool_size(pool) >= sizeof(freeobj_t));
+  assert(mem_pool_size(pool) % Align == 0);
+  void* objs[Objects];
+  for (int i = 0; i < Objects; i++) {
+    objs[i] = mem_pool_alloc(pool);
+  }
+  assert(pool->live == Objects);
+  mem_pool_free(pool, objs[3]);
+  mem_pool_free(pool, objs[7]);
+  assert(pool->live == Objects - 2);
+  assert(mem_pool_alloc(pool) == objs[7]);
+  assert(mem_pool_alloc(pool) == objs[3]);
+  size_t used = arena->used;
+  mem_pool_free(pool, objs[0]);
+  assert(mem_pool_alloc(pool) == objs[0]);
+  assert(arena->used == used);
+  assert(pool->peak == Objects);
+  assert(pool->allocs == Objects + 3);
+
+  // reset drops the pools; a new pool starts over in the same memory
+  mem_arena_reset(arena);
+  assert(arena->pools == NULL);
+  pool = mem_pool_new(arena, "test pool", 1);
+  assert(pool == first[0]);
+  assert(mem_pool_alloc(pool) != NULL);
+  assert(arena->nchunks == nchunks);
+
+  // delete: every chunk, and the arena itself, goes back to the heap
+  mem_arena_delete(arena);
+  assert(mem_net() == baseline);
+
+  printf("All tests passed.\n");
+  return 0;
+}
+
+#endif // UNIT_TEST
@@ -14,6 +14,12 @@
  *    that needs to defensively check function parameters that
  *    "should never be NULL".
  *
+ * 4. Arenas, which hand out memory by bumping a pointer through
+ *    large chunks and take it all back at once, and pools, which
+ *    hand out fixed-size objects from an arena and reuse freed ones.
+ *    Memory that lives exactly as long as a game, or a frame, comes
+ *    from an arena and is released in one step instead of piece by piece.
+ *
  * David Kotz, April 2016, 2017, 2019, 2021
  */
 
@@ -98,7 +104,8 @@ void mem_free(void* ptr);
  * We assume:
  *   caller provides a FILE open for writing, and message suitable for printf.
  * We format and print a report to that FILE, indicating the number of calls
- * to mem_malloc/calloc and of calls to mem_free, and the net difference.
+ * to mem_malloc/calloc and of calls to mem_free, and the net difference,
+ * followed by a line for each live arena and each of its pools.
  */
 void mem_report(FILE* fp, const char* message);
 
@@ -113,4 +120,70 @@ void mem_report(FILE* fp, const char* message);
  */
 int mem_net(void);
 
+/**************** mem_arena_t, mem_pool_t ****************/
+/* Opaque to users of the module. */
+typedef struct mem_arena mem_arena_t;
+typedef struct mem_pool mem_pool_t;
+
+/**************** mem_arena_new() ****************/
+/* Create a new, empty arena.
+ * Caller provides:
+ *   a name for mem_report (not copied; usually a string literal),
+ *   the size of the chunks the arena takes from malloc.
+ * We return:
+ *   the new arena; we exit if out of memory.
+ * Caller is responsible for:
+ *   later calling mem_arena_delete.
+ */
+mem_arena_t* mem_arena_new(const char* name, const size_t chunk_size);
+
+/**************** mem_arena_alloc() ****************/
+/* Allocate size bytes from the arena, suitably aligned for any type.
+ * The memory is NOT cleared, and must NOT be passed to mem_free;
+ * it is released by mem_arena_reset or mem_arena_delete.
+ * We exit if out of memory.
+ */
+void* mem_arena_alloc(mem_arena_t* arena, const size_t size);
+
+/**************** mem_arena_reset() ****************/
+/* Release everything allocated from the arena, including its pools
+ * and their objects, in constant time. The arena keeps its chunks
+ * and hands the same memory out again, so repeated rounds of the
+ * same shape do not grow or fragment the heap.
+ */
+void mem_arena_reset(mem_arena_t* arena);
+
+/**************** mem_arena_delete() ****************/
+/* Release everything allocated from the arena, and the arena itself,
+ * giving its chunks back to the heap. NULL is ignored.
+ */
+void mem_arena_delete(mem_arena_t* arena);
+
+/**************** mem_pool_new() ****************/
+/* Create a pool of objects of the given size within an arena.
+ * Caller provides:
+ *   the arena, a name for mem_report (not copied), the object size.
+ * We return:
+ *   the new pool, which lives until the arena is reset or deleted.
+ */
+mem_pool_t* mem_pool_new(mem_arena_t* arena, const char* name, const size_t size);
+
+/**************** mem_pool_alloc() ****************/
+/* Return an object from the pool: a freed one if there is one,
+ * otherwise a new one from the pool's arena. Not cleared.
+ * We exit if out of memory.
+ */
+void* mem_pool_alloc(mem_pool_t* pool);
+
+/**************** mem_pool_free() ****************/
+/* Return an object to the pool it came from, for reuse.
+ * NULL is ignored.
+ */
+void mem_pool_free(mem_pool_t* pool, void* ptr);
+
+/**************** mem_pool_size() ****************/
+/* Return the size of the pool's objects, or 0 if pool is NULL.
+ */
+size_t mem_pool_size(mem_pool_t* pool);
+
 #endif // __MEM_H
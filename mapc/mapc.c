@@ -0,0 +1,56 @@
+/*
+ * mapc - compiles a map file for instant server startup
+ *
+ * usage: ./mapc map.txt [compiled]
+ *
+ * Writes the map's cells, cell class table, room cells and
+ * visibility table to 'compiled' (by default map.mapc, next
+ * to map.txt), where the server finds and maps them instead
+ * of parsing the map and building the table itself.
+ *
+ * Colinear, 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../libcs50/mem.h"
+#include "../grid/grid.h"
+#include "../vision/vision.h"
+
+/**************** main ****************/
+/* Parses the arguments, loads and compiles the map.
+ * Returns: 0 on success, 1 on bad arguments, 2 on failure.
+ */
+int main(int argc, char* argv[])
+{
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: %s map.txt [compiled]\n", argv[0]);
+        return 1;
+    }
+    char* map_filename = argv[1];
+    char* compiled_filename = (argc == 3) ? argv[2] : grid_compiled_name(map_filename);
+
+    // load the map and build its visibility table the usual way
+    grid_t* grid = grid_new(map_filename);
+    if (grid == NULL) {
+        return 2;
+    }
+    visibility_t* visibility = visibility_new(grid);
+    size_t visibility_size;
+    void* visibility_data = visibility_pack(visibility, &visibility_size);
+
+    bool ok = grid_write_compiled(grid, map_filename, compiled_filename,
+                                  visibility_data, visibility_size);
+    if (ok) {
+        printf("%s -> %s\n", map_filename, compiled_filename);
+    }
+
+    // clean up
+    mem_free(visibility_data);
+    visibility_delete(visibility);
+    grid_delete(grid);
+    if (argc == 2) {
+        mem_free(compiled_filename);
+    }
+    return ok ? 0 : 2;
+}
@@ -6,21 +6,32 @@
  * Colinear, 2024
  */
 
+#define _POSIX_C_SOURCE 200809L         // clock_gettime
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <arpa/inet.h>
 #include "../libcs50/mem.h"
 #include "../support/message.h"
-#include "../libcs50/set.h"
 #include "../grid/grid.h"
 #include "../vision/vision.h"
 #include "../structures/structures.h"
 #include<unistd.h>
 
-#define MaxPlayers 26                   // max number of players
+#define MaxPlayers 1024                 // max number of players
+#define MaxChanges 64                   // changed spots remembered between broadcasts
+#define MaxFrameRate 50                 // fastest a client may ask runs to be animated
+#define TickSeconds 0.01f               // how often message_loop wakes while a run animates
+#define FrameHistory 4                  // frames kept per delta client to encode against
+#define KeyframeInterval 64             // most frames sent between keyframes
+#define MaxSpanGap 4                    // unchanged cells a delta span may run over
+#define MaxWindowSpots 2048             // spots a window may cover before a run sends it early
+#define MoreLineLength 32               // room for the line counting results left out of the summary
 
 /**************** Static constants ****************/
 static const int MaxNameLength = 50;    // max number of chars in playerName
@@ -28,33 +39,130 @@ static const int GoldTotal = 250;        // total amount of gold
 static const int GoldMinNumPiles = 10;   // minimum number of gold piles
 static const int GoldMaxNumPiles = 30;   // maximum number of gold piles
 
+/**************** local types ****************/
+/* What game_over reports about a player: kept for each player
+ * who leaves, once the player itself is gone */
+typedef struct result {
+    struct result* next;                // the next result recorded
+    int score;
+    int id;                             // the player's id; no other player had it
+    char name[];
+} result_t;
+
+/* Protocol options a client asks for on the line after PLAY or SPECTATE */
+typedef struct options {
+    int frameRate;                      // steps per second to animate runs at; 0 runs at once
+    bool delta;                         // send FRAME and DELTA messages in place of DISPLAY
+    bool window;                        // send a player WINDOW messages in place of DISPLAY
+} options_t;
+
+/* A rectangle of display cells, columns x0 to x1-1 of rows y0 to y1-1 */
+typedef struct box {
+    int x0, y0, x1, y1;
+} box_t;
+
+/* The last frames sent to a client that asked for deltas, in one
+ * block from frames_pool: FrameHistory rows buffers follow */
+typedef struct frames {
+    int seq[FrameHistory];              // sequence number of each kept frame; -1 if none
+    int acked;                          // kept frame the client last acknowledged; -1 if none
+    int latest;                         // kept frame sent last; -1 if none
+    int nextSeq;                        // sequence number of the next frame
+    int keyframeSeq;                    // sequence number of the last keyframe
+    char rows[];
+} frames_t;
+
+/* A continuous move being animated, one step per frame */
+typedef struct run {
+    int dx, dy;                         // direction of the run; both 0 when none
+    double due;                         // when the run takes its next step
+} run_t;
+
 /**************** file-local global variables ****************/
-player_t* players[MaxPlayers];          // Array to hold player pointers
+player_t* players[MaxPlayers];          // Array to hold player pointers; NULL for a free slot
 int numPlayers = 0;                     // Current number of players
-grid_t* main_grid;                      // main player grid
-grid_t* original_grid;                  // grid to keep track of symbols (not changed)
+int numSlots = 0;                       // slots of players[] ever used; the rest are NULL
+int freeSlots[MaxPlayers];              // slots below numSlots left by players who quit
+int numFreeSlots = 0;
+int playerIds[MaxPlayers];              // id of the player in each slot, in order of joining
+int nextPlayerId = 0;                   // ids are never given out twice
+result_t* results = NULL;               // results of players who left, in game_arena
+result_t** lastResult = &results;       // where the next result goes
+int numResults = 0;
+grid_t* main_grid;                      // players and gold layered over original_grid
+grid_t* original_grid;                  // base map terrain (not changed)
+visibility_t* visibility;               // line-of-sight table for original_grid
 addr_t spectator;                       // spectator address
 int totalGold = GoldTotal;              // Remaining gold nuggets
-bool flag = false;                      // returned by handle_message to exit message_loop
+bool flag = false;                      // the game is over; handle_batch returns it to exit message_loop
+int changedX[MaxChanges];               // spots of main_grid changed since the last broadcast
+int changedY[MaxChanges];
+char changedWas[MaxChanges];            // symbol each changed spot had at the last broadcast
+int numChanges = 0;                     // number of changed spots; MaxChanges+1 means "too many"
+bool spectatorStale = false;            // spectator needs a display even if nothing changed
+mem_arena_t* game_arena;                // memory that lives as long as the game
+mem_arena_t* frame_arena;               // scratch for handling one message
+mem_pool_t* player_pool;                // player blocks, in game_arena
+intmap_t* occupants;                    // spot index in main_grid -> players[] slot
+intmap_t* senders;                      // address_key of a player's address -> players[] slot
+int frame = 0;                          // number of update_grid calls so far
+int drawnFrame[MaxPlayers];             // frame each player's display was last sent in
+options_t playerOptions[MaxPlayers];    // options each player joined with
+run_t runs[MaxPlayers];                 // each player's animated run, if any
+mem_pool_t* frames_pool;                // frames_t blocks, in game_arena
+size_t frameStride;                     // size of each rows buffer in a frames_t
+frames_t* playerFrames[MaxPlayers];     // frames sent to each player asking for deltas, or NULL
+frames_t* spectatorFrames = NULL;       // frames sent to the spectator, if it asked for deltas
+box_t drawnBox[MaxPlayers];             // the part of each display drawn since it was last sent
+char* spectatorDisplay;                 // the spectator's DISPLAY message, kept up to date in game_arena
+size_t spectatorDisplayLength;
+size_t playerDisplayLength;             // length of a player's DISPLAY message
+int numRuns = 0;                        // number of animated runs under way
+bool ticking = false;                   // message_loop is calling handle_timeout
+bool deferUpdates = false;              // update_grid waits until the whole batch is handled
+bool updateDeferred = false;            // update_grid was called while it waited
 
 /*********** Function prototypes ***********/
 int main(int argc, char* argv[]);
 int parse_args(int argc, char* argv[], char** map_filename, int* seed);
 void initialize_game(char* map_filename, int seed);
 void game_over();
-bool handle_message(void* arg, const addr_t from, const char* message);
+bool handle_batch(void* arg, const received_t* messages, int count);
+void apply_message(const addr_t from, const char* message);
+bool handle_timeout(void* arg);
+bool restart_loop();
+void parse_options(const char* line, options_t* options);
 void process_keystroke(char keystroke, player_t* player);
+int step_player(player_t* player, int dx, int dy);
+void notify_gold(player_t* player, int collected);
+void advance_runs();
+void end_run(int slot);
+double now_seconds();
+frames_t* frames_new();
+void handle_ack(frames_t* frames, int seq);
+void send_frame(addr_t to, frames_t* frames, const char* rows, size_t length);
+int encode_delta(char* dest, size_t limit, const char* rows, const char* base, size_t length);
 void update_grid();
-player_t* add_player(char* name, addr_t* address, char letter);
+void set_main_symbol(pos_t pos, char symbol);
+void send_display(int slot);
+void draw_player(int slot);
+void grow_box(box_t* box, pos_t center, int radius);
+void send_window(int slot);
+char label_player(void* arg, player_t* viewer, int x, int y, char symbol);
+player_t* add_player(char* name, addr_t* address, const options_t* options);
+void remove_player(int slot);
+void record_result(int slot);
 player_t* get_player_by_address(addr_t* address);
-player_t* find_player_at_position(pos_t* pos);
+player_t* find_player_at_position(pos_t pos);
+uint64_t spot_key(pos_t pos);
+void set_occupant(pos_t pos, int slot);
+uint64_t address_key(addr_t address);
 void setup_grid_with_gold(grid_t* grid);
-char* format_grid_message(grid_t* grid);
+char* format_grid_message(grid_t* grid, char* message);
 void send_spectator_gold_message(addr_t spectator);
 void send_gold_message(player_t* player, int collected, int purse);
-int compare_players_by_score(const void* a, const void* b);
-void handle_quit(player_t* player, addr_t spectator, const addr_t* sender, bool isSpectator);
-bool position_equal(pos_t* pos1, pos_t* pos2);
+int compare_results_by_score(const void* a, const void* b);
+void handle_quit(player_t* player, const addr_t* sender, bool isSpectator);
 bool sanitize_name(const char* input_name, char* sanitized_name, addr_t from);
 
 /**************** main ****************/
@@ -71,8 +179,23 @@ int main(int argc, char* argv[]) {
 
     initialize_game(map_filename, seed);
 
-    // Enter the message handling loop
-    message_loop(NULL, 0, NULL, NULL, handle_message);
+    // Messages a handler sends go out together when it returns
+    message_batch_begin();
+
+    // Enter the message handling loop, taking all waiting messages
+    // at once; it wakes on a timer only while some run is being animated
+    while (!flag) {
+        ticking = numRuns > 0;
+        bool ok;
+        if (ticking) {
+            ok = message_loop_batch(NULL, TickSeconds, handle_timeout, NULL, handle_batch);
+        } else {
+            ok = message_loop_batch(NULL, 0, NULL, NULL, handle_batch);
+        }
+        if (!ok) {
+            return 1;
+        }
+    }
     return 0;
 }
 
@@ -139,29 +262,76 @@ initialize_game(char* map_filename, int seed)
         exit(1);
     }
 
-    // Load the grid
-    main_grid = grid_new(map_filename);
-    original_grid = grid_new(map_filename);
+    // Load the grid, compiled if mapc has compiled it
+    char* compiled_filename = grid_compiled_name(map_filename);
+    original_grid = grid_load_compiled(compiled_filename, map_filename);
+    mem_free(compiled_filename);
+    main_grid = grid_new_layer(original_grid);
     if (main_grid == NULL) {
         fprintf(stderr, "Failed to initialize grid\n");
         exit(1);
     }
 
+    // Precompute what each spot can see (unless mapc did); the base map never changes
+    visibility = visibility_new(original_grid);
+
+    // Players come from a pool sized for this map; frame scratch fits a full display
+    int width = grid_get_width(main_grid);
+    int height = grid_get_height(main_grid);
+    game_arena = mem_arena_new("game", 64 * 1024);
+    player_pool = mem_pool_new(game_arena, "players", player_size(width, height, MaxNameLength));
+    frame_arena = mem_arena_new("frame", 2 * (size_t)width * height + 1024);
+    occupants = intmap_new(MaxPlayers);
+    senders = intmap_new(MaxPlayers);
+
+    // Delta clients keep a few frames, each the rows of a player's display
+    frameStride = (size_t)height * (width + 1) + 1;
+    frames_pool = mem_pool_new(game_arena, "frames", sizeof(frames_t) + FrameHistory * frameStride);
+    playerDisplayLength = strlen("DISPLAY\n") + (size_t)height * (width + 1);
+
     // Set up grid with gold
     setup_grid_with_gold(main_grid);
+
+    // The spectator's display, which update_grid keeps up to date
+    spectatorDisplay = format_grid_message(main_grid, NULL);
+    spectatorDisplayLength = strlen(spectatorDisplay);
 }
 
-/**************** handle_message ****************/
-/* Processes incoming messages from players or the spectator.
- * Handles actions like movement, joining, and quitting.
- * Returns: true to continue receiving messages, false to quit (using flag)
+/**************** handle_batch ****************/
+/* Processes all the messages waiting for the server, in the order
+ * they arrived, then updates the grid once for all of them, so a
+ * burst of keystrokes is broadcast as one frame.
+ * Returns: true to leave message_loop (see restart_loop)
  */
 bool
-handle_message(void* arg, const addr_t from, const char* message)
+handle_batch(void* arg, const received_t* messages, int count)
 {
     if (flag) {
         return true;
     }
+    // Scratch from the last batch is no longer needed
+    mem_arena_reset(frame_arena);
+
+    deferUpdates = true;
+    advance_runs();
+    // Messages after the last nugget was taken come after the game is over
+    for (int i = 0; i < count && totalGold > 0; i++) {
+        apply_message(messages[i].from, messages[i].buf);
+    }
+    deferUpdates = false;
+    if (updateDeferred) {
+        update_grid();
+    }
+    return restart_loop();
+}
+
+/**************** apply_message ****************/
+/* Applies one message from a player or the spectator: movement,
+ * joining, quitting, and acknowledging frames.
+ */
+void
+apply_message(const addr_t from, const char* message)
+{
     // Handle "KEY" messages for player movement or actions
     if (strncmp(message, "KEY ", 4) == 0) {
         char keystroke = message[4];
@@ -178,8 +348,8 @@ handle_message(void* arg, const addr_t from, const char* message)
             }
 
             // Handle player or spectator quitting
-            handle_quit(player, spectator, &from, isSpectator);
-            return false;
+            handle_quit(player, &from, isSpectator);
+            return;
         }
 
         // Find the player associated with the message sender
@@ -201,35 +371,76 @@ handle_message(void* arg, const addr_t from, const char* message)
         }
         spectator = from;
 
+        // Options, if any, are on the line after SPECTATE
+        options_t options = {0};
+        const char* options_start = strchr(message, '\n');
+        if (options_start != NULL) {
+            parse_options(options_start + 1, &options);
+        }
+        if (spectatorFrames != NULL) {
+            mem_pool_free(frames_pool, spectatorFrames);
+            spectatorFrames = NULL;
+        }
+        if (options.delta) {
+            spectatorFrames = frames_new();
+        }
+
         // Send grid dimensions and gold message to the new spectator
         char welcome_message[128];
         snprintf(welcome_message, sizeof(welcome_message),
                     "GRID %d %d", grid_get_height(main_grid), grid_get_width(main_grid));
         message_send(from, welcome_message);
         send_spectator_gold_message(spectator);
+        spectatorStale = true;
         update_grid();
     }
 
+    // Handle acknowledgements of frames from delta clients
+    else if (strncmp(message, "ACK ", 4) == 0) {
+        int seq;
+        int slot;
+        if (sscanf(message + 4, "%d", &seq) == 1) {
+            if (message_isAddr(spectator) && message_eqAddr(spectator, from)) {
+                handle_ack(spectatorFrames, seq);
+            } else if (intmap_find(senders, address_key(from), &slot)) {
+                handle_ack(playerFrames[slot], seq);
+            }
+        }
+    }
+
     // Handle player join messages
     else if (strncmp(message, "PLAY ", 5) == 0) {
         // Check if the maximum number of players has been reached
         if (numPlayers >= MaxPlayers) {
             message_send(from, "QUIT Game is full: no more players can join.");
-            return false;
+            return;
+        }
+
+        // One player per address: a second PLAY would leave a player
+        // no message could reach, so keep the one already playing
+        if (intmap_find(senders, address_key(from), NULL)) {
+            message_send(from, "ERROR You are already playing.");
+            return;
+        }
+
+        // Extract the player's name, and the options on the line after it, if any
+        char* real_name_start = mem_arena_alloc(frame_arena, strlen(message + 5) + 1);
+        strcpy(real_name_start, message + 5);
+        options_t options = {0};
+        char* options_start = strchr(real_name_start, '\n');
+        if (options_start != NULL) {
+            *options_start = '\0';
+            parse_options(options_start + 1, &options);
         }
 
-        // Extract and sanitize the player's name
-        const char* real_name_start = message + 5;
+        // Sanitize the player's name
         char sanitized_name[MaxNameLength + 1];
         if (!sanitize_name(real_name_start, sanitized_name, from)) {
-            return false; // Name is invalid, already sent QUIT message
+            return; // Name is invalid, already sent QUIT message
         }
 
-        // Assign a unique letter to the player
-        char player_letter = 'A' + numPlayers; // Assign unique letter
-
         // Add the player to the game
-        player_t* new_player = add_player(sanitized_name, (addr_t*)&from, player_letter);
+        player_t* new_player = add_player(sanitized_name, (addr_t*)&from, &options);
         if (new_player != NULL) {
             // Send the player a welcome message and initial gold status
             char welcome_message[128];
@@ -237,6 +448,9 @@ handle_message(void* arg, const addr_t from, const char* message)
                     "GRID %d %d", grid_get_height(main_grid), grid_get_width(main_grid));
             message_send(from, welcome_message);
             send_gold_message(new_player, 0, 0);
+            if (message_isAddr(spectator)) {
+                send_spectator_gold_message(spectator);
+            }
 
             // Update grid to reflect the new player
             update_grid();
@@ -245,8 +459,58 @@ handle_message(void* arg, const addr_t from, const char* message)
             message_send(from, "QUIT Error adding player.");
         }
     }
-    // Return the flag to indicate whether to continue processing messages
-    return flag;
+}
+
+/**************** handle_timeout ****************/
+/* Called by message_loop every TickSeconds while runs are
+ * animated; takes the steps that are due.
+ * Returns: true to leave message_loop (see restart_loop)
+ */
+bool
+handle_timeout(void* arg)
+{
+    mem_arena_reset(frame_arena);
+    advance_runs();
+    return restart_loop();
+}
+
+/**************** restart_loop ****************/
+/* Returns true if message_loop should return to main: the game
+ * is over, or animated runs began or ended, so main must start
+ * or stop the timer.
+ */
+bool
+restart_loop()
+{
+    return flag || (numRuns > 0) != ticking;
+}
+
+/**************** parse_options ****************/
+/* Reads the space-separated protocol options a client sent on the
+ * line after PLAY or SPECTATE into *options. Understands
+ *   fps=N  animate continuous moves at N steps per second
+ *   delta  send FRAME and DELTA messages (see send_frame)
+ *   window send a player WINDOW messages (see send_window); a
+ *          player asking for both gets windows
+ * and ignores any other, so clients may offer options a server
+ * does not know.
+ */
+void
+parse_options(const char* line, options_t* options)
+{
+    char word[32];
+    int used;
+    while (sscanf(line, "%31s%n", word, &used) == 1) {
+        line += used;
+        int value;
+        if (sscanf(word, "fps=%d", &value) == 1) {
+            options->frameRate = value < 0 ? 0 : value > MaxFrameRate ? MaxFrameRate : value;
+        } else if (strcmp(word, "delta") == 0) {
+            options->delta = true;
+        } else if (strcmp(word, "window") == 0) {
+            options->window = true;
+        }
+    }
 }
 
 /**************** process_keystroke ****************/
@@ -282,102 +546,253 @@ process_keystroke(char keystroke, player_t* player)
     // Determine if movement is continuous (uppercase letters)
     bool isContinuous = (keystroke >= 'A' && keystroke <= 'Z' && keystroke != 'Q'); // Uppercase = continuous
 
-    pos_t* current_pos = get_player_position(player);
+    // Any keystroke ends the player's animated run
+    int slot = -1;
+    intmap_find(occupants, spot_key(get_player_position(player)), &slot);
+    end_run(slot);
 
-    // Process movement
-    while (true) {
-        pos_t* new_pos = position_new(get_position_x(current_pos) + dx, get_position_y(current_pos) + dy);
+    if (isContinuous && playerOptions[slot].frameRate > 0) {
+        // Animate the run: the first step now, the rest as they come due
+        runs[slot] = (run_t){ .dx = dx, .dy = dy, .due = now_seconds() };
+        numRuns++;
+        advance_runs();
+        return;
+    }
 
-        if (!grid_valid_position(main_grid, new_pos)) {
+    // Process movement; a continuous run goes to its end before anyone
+    // hears of it, and its gold comes in one notification
+    int collected = 0;
+    bool moved = false;
+    while (true) {
+        int gold = step_player(player, dx, dy);
+        if (gold < 0) {
             // Invalid position: stop movement
-            position_delete(new_pos);
             break;
         }
+        moved = true;
+        collected += gold;
+
+        if (!isContinuous) {
+            // Stop if the movement is not continuous
+            break; 
+        }
+        // The player still learns the map it runs past
+        draw_player(slot);
+    }
+    if (collected > 0) {
+        notify_gold(player, collected);
+    }
+    if (moved) {
+        // While a batch is handled the update waits for the rest of it,
+        // but the player still learns the map where it stepped
+        if (deferUpdates && !isContinuous) {
+            draw_player(slot);
+        }
+        // Update the grid for all players
+        update_grid();
+    }
+}
+
+/**************** step_player ****************/
+/* Moves the player one step by (dx, dy), swapping places with any
+ * player there, and collects gold on the new spot. Changes reach
+ * the other players at the next update_grid.
+ * Returns: the gold collected, or -1 if the player cannot move there.
+ */
+int
+step_player(player_t* player, int dx, int dy)
+{
+    pos_t current_pos = get_player_position(player);
+    pos_t new_pos = position_at(get_position_x(current_pos) + dx, get_position_y(current_pos) + dy);
 
-        player_t* other_player = find_player_at_position(new_pos);
-        if (other_player != NULL) {
-            // Swap positions with another player
-            pos_t* current_pos = get_player_position(player);
-            pos_t* other_player_pos = get_player_position(other_player);
+    if (!grid_valid_position(main_grid, new_pos)) {
+        return -1;
+    }
 
-            // Swap positions
-            double temp_x = get_position_x(current_pos);
-            double temp_y = get_position_y(current_pos);
-            set_position_x(current_pos, get_position_x(other_player_pos));
-            set_position_y(current_pos, get_position_y(other_player_pos));
-            set_position_x(other_player_pos, temp_x);
-            set_position_y(other_player_pos, temp_y);
+    int slot = -1;
+    intmap_find(occupants, spot_key(current_pos), &slot);
+    player_t* other_player = find_player_at_position(new_pos);
+    if (other_player != NULL) {
+        // Swap positions with another player
+        int other_slot = -1;
+        intmap_find(occupants, spot_key(new_pos), &other_slot);
+        set_player_position(player, new_pos);
+        set_player_position(other_player, current_pos);
+        set_occupant(new_pos, slot);
+        set_occupant(current_pos, other_slot);
+
+        // Update grid symbols for both players
+        set_main_symbol(new_pos, get_player_letter(player));
+        set_main_symbol(current_pos, get_player_letter(other_player));
+    } else {
+        // Move player to the new position
+        set_main_symbol(current_pos, grid_get_symbol(original_grid, current_pos));
+        set_occupant(current_pos, -1);
+        set_player_position(player, new_pos);
+        set_main_symbol(new_pos, get_player_letter(player));
+        set_occupant(new_pos, slot);
+    }
 
-            // Update grid symbols for both players
-            grid_set_symbol(main_grid, current_pos, get_player_letter(player));
-            grid_set_symbol(main_grid, other_player_pos, get_player_letter(other_player));
+    // Handle gold collection
+    int gold = grid_get_gold(main_grid, new_pos);
+    if (gold > 0) {
+        // Update player score and grid gold status
+        set_player_score(player, get_player_score(player) + gold);
+        grid_remove_gold(main_grid, new_pos);
+        totalGold -= gold;
+    }
+    return gold;
+}
 
-            // Reflect the changes on the grid
-            update_grid();
-        } else {
-            // Move player to the new position
-            grid_set_symbol(main_grid, current_pos, grid_get_symbol(original_grid, current_pos));
-            set_player_position_values(player, new_pos);
-            grid_set_symbol(main_grid, new_pos, get_player_letter(player));
+/**************** notify_gold ****************/
+/* Tells the player it collected gold, and everyone else the
+ * gold that remains.
+ */
+void
+notify_gold(player_t* player, int collected)
+{
+    // Notify player of gold collection
+    send_gold_message(player, collected, get_player_score(player));
+    // Notify other players of updated scores
+    for (int i = 0; i < numSlots; i++) {
+        if (players[i] != NULL && players[i] != player) {
+            send_gold_message(players[i], 0, get_player_score(players[i]));    
         }
+    }
+    // Notify the spectator of the updated total gold (if present), once
+    if (message_isAddr(spectator)) {
+        send_spectator_gold_message(spectator);
+    }
+}
 
-        // Handle gold collection
-        int gold = grid_get_gold(main_grid, get_player_position(player));
+/**************** advance_runs ****************/
+/* Takes a step for every animated run that is due, ending those
+ * that are blocked, and updates the grid once for all of them.
+ */
+void
+advance_runs()
+{
+    if (numRuns == 0) {
+        return;
+    }
+    double now = now_seconds();
+    bool moved = false;
+    for (int slot = 0; slot < numSlots; slot++) {
+        run_t* run = &runs[slot];
+        if (players[slot] == NULL || (run->dx == 0 && run->dy == 0) || run->due > now) {
+            continue;
+        }
+        int gold = step_player(players[slot], run->dx, run->dy);
+        if (gold < 0) {
+            end_run(slot);
+            continue;
+        }
+        moved = true;
         if (gold > 0) {
-            // Update player score and grid gold status
-            set_player_score(player, get_player_score(player) + gold);
-            grid_remove_gold(main_grid, get_player_position(player));
-            totalGold -= gold;
-
-            // Notify player of gold collection
-            send_gold_message(player, gold, get_player_score(player));
-            // Notify other players of updated scores
-            for (int i = 0; i < numPlayers; i++) {
-                if (!message_eqAddr(get_player_address(players[i]), get_player_address(player))) {
-                    send_gold_message(players[i], 0, get_player_score(players[i]));    
-                }
-            }
+            notify_gold(players[slot], gold);
         }
-        // Update the grid for all players
+        // Keep to the frame rate, without bursting to catch up after a delay
+        double interval = 1.0 / playerOptions[slot].frameRate;
+        run->due = run->due + interval > now ? run->due + interval : now + interval;
+    }
+    if (moved) {
         update_grid();
-        // Free memory for new_pos after use
-        position_delete(new_pos); 
+    }
+}
 
-        if (!isContinuous) {
-            // Stop if the movement is not continuous
-            break; 
-        }
+/**************** end_run ****************/
+/* Stops the animated run of the player in players[slot], if any.
+ */
+void
+end_run(int slot)
+{
+    if (slot >= 0 && (runs[slot].dx != 0 || runs[slot].dy != 0)) {
+        runs[slot].dx = runs[slot].dy = 0;
+        numRuns--;
     }
 }
 
+/**************** now_seconds ****************/
+/* Returns the time in seconds on a clock that only moves forward.
+ */
+double
+now_seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
 /**************** update_grid ****************/
-/* Updates the grid view for all players and the spectator.
- * Sends the updated visible grid to each player and the 
- * complete grid to the spectator. Ends the game if no gold remains.
+/* Updates the grid view for the players and the spectator.
+ * Sends the updated visible grid to each player that can see
+ * a spot changed since the last update, and the complete grid
+ * to the spectator. Ends the game if no gold remains.
  */
 void update_grid() {
-    // Update each player's visible grid
-    for (int i = 0; i < numPlayers; i++) {
-        if (players[i] != NULL) {
-            // Calculate the visible grid for the player
-            grid_t* visible_grid = calc_grid(main_grid, players[i]);
-            // Calculate the visible grid for the player
-            char* message = format_grid_message(visible_grid);
-            message_send(get_player_address(players[i]), message);
-            // Free allocated resources
-            mem_free(message);
-            grid_delete(visible_grid);
+    if (deferUpdates) {
+        updateDeferred = true;
+        return;
+    }
+    updateDeferred = false;
+    frame++;
+    if (numChanges > MaxChanges) {
+        // Too many changes to track: update everyone
+        for (int i = 0; i < numSlots; i++) {
+            if (players[i] != NULL) {
+                send_display(i);
+            }
+        }
+    } else {
+        // Update each player within vision radius of a change, found
+        // through the occupancy index; a player who moved always is,
+        // since the spot it stands on is kept as changed
+        int radius = visibility_get_radius(visibility);
+        for (int c = 0; c < numChanges; c++) {
+            for (int dy = -radius; dy <= radius; dy++) {
+                for (int dx = -radius; dx <= radius; dx++) {
+                    pos_t pos = position_at(changedX[c] + dx, changedY[c] + dy);
+                    int slot;
+                    if (dx * dx + dy * dy <= radius * radius && grid_is_inside(main_grid, pos)
+                        && intmap_find(occupants, spot_key(pos), &slot) && drawnFrame[slot] != frame) {
+                        send_display(slot);
+                    }
+                }
+            }
         }
     }
 
     // Update the spectator's grid if a spectator is present
-    if (message_isAddr(spectator)) {
-        // Format and send the full grid to the spectator
-        char* full_message = format_grid_message(main_grid);
-        message_send(spectator, full_message);
-        // Free message
-        mem_free(full_message);
+    if (message_isAddr(spectator) && (numChanges > 0 || spectatorStale)) {
+        // Bring the spectator's display up to date: just the changed
+        // spots, unless there were too many or it has been away
+        char* rows = strchr(spectatorDisplay, '\n') + 1;
+        if (numChanges > MaxChanges || spectatorStale) {
+            format_grid_message(main_grid, spectatorDisplay);
+        } else {
+            int width = grid_get_width(main_grid) - 1;
+            int height = grid_get_height(main_grid) - 1;
+            for (int c = 0; c < numChanges; c++) {
+                if (changedX[c] < width && changedY[c] < height) {
+                    rows[changedY[c] * (width + 1) + changedX[c]] =
+                        grid_get_symbol_at(main_grid, changedX[c], changedY[c]);
+                }
+            }
+        }
+
+        // Send it straight from there
+        if (spectatorFrames != NULL) {
+            send_frame(spectator, spectatorFrames, rows, spectatorDisplayLength - (rows - spectatorDisplay));
+        } else {
+            message_send_buf(spectator, spectatorDisplay, spectatorDisplayLength);
+        }
     }
+    numChanges = 0;
+    spectatorStale = false;
+
+    // Send this round now: the displays are sent from where they are
+    // drawn, and may be drawn again before the handler returns
+    message_batch_flush(NULL);
 
     // Check if the game should end
     if(totalGold == 0) {
@@ -385,32 +800,359 @@ void update_grid() {
     }
 }
 
+/**************** set_main_symbol ****************/
+/* Sets a symbol in main_grid and remembers the spot as
+ * changed, so the next update_grid reaches the players
+ * who can see it. Only net changes are kept: a spot is
+ * recorded once, and forgotten again when it gets back the
+ * terrain it had at the last broadcast, so a run costs just
+ * the spots it starts and ends on (and any gold it takes).
+ * A spot holding a player is always kept, since another
+ * player may have come there under the same letter.
+ */
+void
+set_main_symbol(pos_t pos, char symbol)
+{
+    char was = grid_get_symbol(main_grid, pos);
+    grid_set_symbol(main_grid, pos, symbol);
+    if (numChanges > MaxChanges) {
+        return;                         // already too many; everyone updates
+    }
+    bool terrain = !isupper((unsigned char)symbol);
+    int x = get_position_x(pos);
+    int y = get_position_y(pos);
+
+    // Find the spot among those already changed; there are few
+    for (int c = 0; c < numChanges; c++) {
+        if (changedX[c] == x && changedY[c] == y) {
+            if (terrain && symbol == changedWas[c]) {
+                // Back as it was: drop it, moving the last one here
+                numChanges--;
+                changedX[c] = changedX[numChanges];
+                changedY[c] = changedY[numChanges];
+                changedWas[c] = changedWas[numChanges];
+            }
+            return;
+        }
+    }
+    if (terrain && symbol == was) {
+        return;
+    }
+    if (numChanges < MaxChanges) {
+        changedX[numChanges] = x;
+        changedY[numChanges] = y;
+        changedWas[numChanges] = was;
+        numChanges++;
+    } else {
+        numChanges = MaxChanges + 1;    // too many to track; everyone updates
+    }
+}
+
+/**************** send_display ****************/
+/* Brings the display of the player in players[slot] up to
+ * date, with other players labelled as it sees them, and
+ * sends it to the player.
+ */
+void
+send_display(int slot)
+{
+    drawnFrame[slot] = frame;
+    draw_player(slot);
+    char* display = get_player_display(players[slot]);
+    if (playerOptions[slot].window) {
+        send_window(slot);
+    } else if (playerFrames[slot] != NULL) {
+        char* rows = strchr(display, '\n') + 1;
+        send_frame(get_player_address(players[slot]), playerFrames[slot], rows,
+                   playerDisplayLength - (rows - display));
+    } else {
+        message_send_buf(get_player_address(players[slot]), display, playerDisplayLength);
+    }
+    drawnBox[slot] = (box_t){ 0, 0, 0, 0 };
+}
+
+/**************** draw_player ****************/
+/* Brings the display of the player in players[slot] up to date,
+ * growing drawnBox[slot] over every spot calc_grid may have touched:
+ * those within the vision radius of its last and current positions.
+ * A player taking windows is sent the box so far once it covers
+ * MaxWindowSpots, so a long run does not send its bounding box.
+ */
+void
+draw_player(int slot)
+{
+    player_t* player = players[slot];
+    box_t* box = &drawnBox[slot];
+    if (playerOptions[slot].window && (box->x1 - box->x0) * (box->y1 - box->y0) > MaxWindowSpots) {
+        send_window(slot);
+        message_batch_flush(NULL);      // before the display it points into changes
+        *box = (box_t){ 0, 0, 0, 0 };
+    }
+    int radius = visibility_get_radius(visibility);
+    grow_box(&drawnBox[slot], get_player_view_position(player), radius);
+    calc_grid(main_grid, visibility, player, label_player, NULL);
+    grow_box(&drawnBox[slot], get_player_position(player), radius);
+}
+
+/**************** grow_box ****************/
+/* Grows box, if need be, to cover the square of the given radius
+ * around center, within the grid. An empty box (x0 == x1) just
+ * becomes that square; a center off the grid adds nothing.
+ */
+void
+grow_box(box_t* box, pos_t center, int radius)
+{
+    int x = get_position_x(center);
+    int y = get_position_y(center);
+    if (x < 0 || y < 0) {
+        return;
+    }
+    int x0 = x - radius < 0 ? 0 : x - radius;
+    int y0 = y - radius < 0 ? 0 : y - radius;
+    int x1 = x + radius + 1 > grid_get_width(main_grid) ? grid_get_width(main_grid) : x + radius + 1;
+    int y1 = y + radius + 1 > grid_get_height(main_grid) ? grid_get_height(main_grid) : y + radius + 1;
+    if (box->x0 == box->x1) {
+        *box = (box_t){ x0, y0, x1, y1 };
+    } else {
+        box->x0 = x0 < box->x0 ? x0 : box->x0;
+        box->y0 = y0 < box->y0 ? y0 : box->y0;
+        box->x1 = x1 > box->x1 ? x1 : box->x1;
+        box->y1 = y1 > box->y1 ? y1 : box->y1;
+    }
+}
+
+/**************** send_window ****************/
+/* Sends the player in players[slot] the part of its display drawn
+ * since it was last sent, drawnBox[slot], as
+ *   WINDOW x y w h\nstring
+ * where string is h rows of w cells, each ending in a newline, to be
+ * placed with its top-left cell at column x of row y. The rest of the
+ * display is as last sent. A box too big for one message goes in
+ * bands of rows, one message each. The rows go out from the display
+ * itself, each a piece of the message followed by a newline piece.
+ */
+void
+send_window(int slot)
+{
+    box_t box = drawnBox[slot];
+    if (box.x0 == box.x1) {
+        return;
+    }
+    const char* rows = strchr(get_player_display(players[slot]), '\n') + 1;
+    int stride = grid_get_width(main_grid) + 1;
+    int width = box.x1 - box.x0;
+    int band = (message_MaxBytes - 64) / (width + 1);
+    if (band > (message_MaxPieces - 1) / 2) {
+        band = (message_MaxPieces - 1) / 2;
+    }
+    struct iovec* pieces = mem_arena_alloc(frame_arena, (1 + 2 * band) * sizeof(struct iovec));
+    for (int y = box.y0; y < box.y1; y += band) {
+        int height = box.y1 - y < band ? box.y1 - y : band;
+        char* header = mem_arena_alloc(frame_arena, 64);
+        pieces[0] = (struct iovec){ header, snprintf(header, 64, "WINDOW %d %d %d %d\n", box.x0, y, width, height) };
+        for (int row = 0; row < height; row++) {
+            pieces[1 + 2 * row] = (struct iovec){ (char*)rows + (size_t)(y + row) * stride + box.x0, width };
+            pieces[2 + 2 * row] = (struct iovec){ "\n", 1 };
+        }
+        message_sendv(get_player_address(players[slot]), pieces, 1 + 2 * height);
+    }
+}
+
+/**************** frames_new ****************/
+/* Returns a frames_t from frames_pool with no frames kept yet.
+ */
+frames_t*
+frames_new()
+{
+    frames_t* frames = mem_pool_alloc(frames_pool);
+    for (int i = 0; i < FrameHistory; i++) {
+        frames->seq[i] = -1;
+    }
+    frames->acked = frames->latest = -1;
+    frames->nextSeq = 0;
+    frames->keyframeSeq = -1;
+    return frames;
+}
+
+/**************** handle_ack ****************/
+/* Makes frame seq, if still kept and newer than the one
+ * acknowledged before, the frame the client's next delta
+ * is encoded against. Does nothing if frames is NULL.
+ */
+void
+handle_ack(frames_t* frames, int seq)
+{
+    if (frames == NULL) {
+        return;
+    }
+    for (int i = 0; i < FrameHistory; i++) {
+        if (frames->seq[i] == seq && (frames->acked < 0 || seq > frames->seq[frames->acked])) {
+            frames->acked = i;
+        }
+    }
+}
+
+/**************** send_frame ****************/
+/* Sends rows, length chars of newline-terminated display rows, to a client
+ * that asked for deltas, unless they are what it was sent last.
+ * The client gets
+ *   DELTA seq base\nrow column text\n...
+ * with the spans of text that differ from frame base, the last frame
+ * it acknowledged; or a keyframe
+ *   FRAME seq\nrows
+ * if it has acknowledged none, KeyframeInterval frames have gone
+ * since the last keyframe, or the delta would be no smaller.
+ * Clients reply "ACK seq" to each frame they have.
+ */
+void
+send_frame(addr_t to, frames_t* frames, const char* rows, size_t length)
+{
+    if (frames->latest >= 0
+        && memcmp(frames->rows + frames->latest * frameStride, rows, length) == 0) {
+        return;     // nothing the client has not seen
+    }
+
+    // Keep the frame in place of the oldest, but never the acknowledged one
+    int keep = -1;
+    for (int i = 0; i < FrameHistory; i++) {
+        if (i != frames->acked && (keep < 0 || frames->seq[i] < frames->seq[keep])) {
+            keep = i;
+        }
+    }
+    int seq = frames->nextSeq++;
+    frames->seq[keep] = seq;
+    frames->latest = keep;
+    memcpy(frames->rows + keep * frameStride, rows, length);
+
+    // A delta against the acknowledged frame, if it comes out smaller
+    if (frames->acked >= 0 && seq - frames->keyframeSeq < KeyframeInterval) {
+        size_t size = length + 64;
+        char* message = mem_arena_alloc(frame_arena, size);
+        int header = snprintf(message, size, "DELTA %d %d\n", seq, frames->seq[frames->acked]);
+        int spans = encode_delta(message + header, length, rows,
+                                 frames->rows + frames->acked * frameStride, length);
+        if (spans >= 0) {
+            message_send_buf(to, message, header + spans);
+            return;
+        }
+    }
+
+    // Otherwise a keyframe, its rows sent from the copy kept
+    char* header = mem_arena_alloc(frame_arena, 64);
+    struct iovec pieces[2] = {
+        { header, snprintf(header, 64, "FRAME %d\n", seq) },
+        { frames->rows + keep * frameStride, length },
+    };
+    frames->keyframeSeq = seq;
+    message_sendv(to, pieces, 2);
+}
+
+/**************** encode_delta ****************/
+/* Writes to dest, as lines "row column text", the spans of rows that
+ * differ from base; both are length chars of newline-terminated rows.
+ * Changes fewer than MaxSpanGap cells apart share a span.
+ * Returns: the chars written, or -1 if they would not fit in limit.
+ */
+int
+encode_delta(char* dest, size_t limit, const char* rows, const char* base, size_t length)
+{
+    size_t used = 0;
+    size_t rowStart = 0;
+    int y = 0;
+    dest[0] = '\0';
+    for (size_t i = 0; i < length; ) {
+        if (rows[i] == '\n') {
+            y++;
+            rowStart = ++i;
+        } else if (rows[i] == base[i]) {
+            i++;
+        } else {
+            // A span from here to the last change before a long enough gap
+            size_t end = i + 1;
+            for (size_t j = end; j < length && rows[j] != '\n' && j < end + MaxSpanGap; j++) {
+                if (rows[j] != base[j]) {
+                    end = j + 1;
+                }
+            }
+            int n = snprintf(dest + used, limit - used, "%d %zu %.*s\n",
+                             y, i - rowStart, (int)(end - i), rows + i);
+            if (n < 0 || (size_t)n >= limit - used) {
+                return -1;
+            }
+            used += n;
+            i = end;
+        }
+    }
+    return used;
+}
+
+/**************** label_player ****************/
+/* calc_grid's label function: a spot of main_grid that holds
+ * a player shows the letter the viewer knows that player by
+ * (see get_player_label); any other occupant shows as itself.
+ */
+char
+label_player(void* arg, player_t* viewer, int x, int y, char symbol)
+{
+    int slot;
+    if (!intmap_find(occupants, spot_key(position_at(x, y)), &slot)) {
+        return symbol;
+    }
+    return get_player_label(viewer, playerIds[slot], frame);
+}
+
 /**************** game_over ****************/
 /* Ends the game and sends the final scores to all players and the spectator (if present).
  * Deletes all players, grids, and cleans up resources.
  */
 void game_over() {
-    char summary[1024];
-    snprintf(summary, sizeof(summary), "QUIT GAME OVER:\n");
-    // Sort players by score in descending order
-    qsort(players, numPlayers, sizeof(player_t*), compare_players_by_score);
-    // Append each player's summary to the game over message
-    for (int i = 0; i < numPlayers; i++) {
+    // Players still here get results too; rank everyone by score
+    for (int i = 0; i < numSlots; i++) {
         if (players[i] != NULL) {
-            char line[1000];
-            snprintf(line, sizeof(line), "%c %d %s\n",
-                        get_player_letter(players[i]),
-                        get_player_score(players[i]),
-                        get_player_name(players[i]));
-            strncat(summary, line, sizeof(summary) - strlen(summary) - 1);
+            record_result(i);
+        }
+    }
+    result_t** ranked = mem_arena_alloc(frame_arena, (numResults + 1) * sizeof(result_t*));
+    int n = 0;
+    for (result_t* result = results; result != NULL; result = result->next) {
+        ranked[n++] = result;
+    }
+    qsort(ranked, n, sizeof(result_t*), compare_results_by_score);
+
+    // The header and a line of tag, score and name per player, best
+    // first, as many as fit in one message; the rest are only counted.
+    // A player's tag is its letter, with the number of times the letters
+    // had gone round before it joined, if any: A, ..., Z, A1, ..., Z1, A2
+    size_t size = 32 + MoreLineLength + (size_t)n * (MaxNameLength + 32);
+    if (size > (size_t)message_MaxBytes + 1) {
+        size = message_MaxBytes + 1;
+    }
+    char* summary = mem_arena_alloc(frame_arena, size);
+    size_t length = snprintf(summary, size, "QUIT GAME OVER:\n");
+    int shown = 0;
+    for (; shown < n; shown++) {
+        char line[MaxNameLength + 32];
+        result_t* result = ranked[shown];
+        int round = result->id / 26;
+        int line_length = (round == 0)
+            ? snprintf(line, sizeof(line), "%c %d %s\n",
+                       'A' + result->id % 26, result->score, result->name)
+            : snprintf(line, sizeof(line), "%c%d %d %s\n",
+                       'A' + result->id % 26, round, result->score, result->name);
+        if (length + line_length + MoreLineLength > size - 1) {
+            break;
         }
+        memcpy(summary + length, line, line_length + 1);
+        length += line_length;
+    }
+    if (shown < n) {
+        snprintf(summary + length, size - length, "and %d more\n", n - shown);
     }
 
     // Send the game over summary to all players
-    for (int i = 0; i < numPlayers; i++) {
+    for (int i = 0; i < numSlots; i++) {
         if (players[i] != NULL) {
             message_send(get_player_address(players[i]), summary);
-            player_delete(players[i]);
             players[i] = NULL;
         }
     }
@@ -420,10 +1162,27 @@ void game_over() {
         message_send(spectator, summary);
     }
 
-    // Clean up resources
+    // Clean up resources; the players and results go all at once with game_arena
     numPlayers = 0;
+    numSlots = 0;
+    numFreeSlots = 0;
+    results = NULL;
+    lastResult = &results;
+    numResults = 0;
+    numRuns = 0;
+    memset(runs, 0, sizeof(runs));
+    memset(playerFrames, 0, sizeof(playerFrames));
+    spectatorFrames = NULL;
+#ifdef MEMTEST
+    mem_report(stderr, "game over");
+#endif
+    mem_arena_delete(game_arena);
+    mem_arena_delete(frame_arena);
+    intmap_delete(occupants);
+    intmap_delete(senders);
     grid_delete(main_grid);
     grid_delete(original_grid);
+    visibility_delete(visibility);
     message_done();
     // Signal that the game has ended
     flag = true;
@@ -431,16 +1190,35 @@ void game_over() {
 
 
 /**************** find_player_at_position ****************/
-/* Finds and returns the player located at the specified position.
+/* Finds and returns the player located at the specified position,
+ * by looking the spot up in the occupancy index.
  * If no player is at the position, returns NULL.
  */
-player_t* find_player_at_position(pos_t* pos) {
-   for (int i = 0; i < numPlayers; i++) {
-       if (players[i] != NULL && position_equal(get_player_position(players[i]), pos)) {
-           return players[i];
-       }
+player_t* find_player_at_position(pos_t pos) {
+   int slot;
+   if (!grid_is_inside(main_grid, pos) || !intmap_find(occupants, spot_key(pos), &slot)) {
+       return NULL;
+   }
+   return players[slot];
+}
+
+/**************** spot_key ****************/
+/* Returns the key of a spot of main_grid in the occupancy index.
+ */
+uint64_t spot_key(pos_t pos) {
+   return (uint64_t)get_position_y(pos) * grid_get_stride(main_grid) + get_position_x(pos);
+}
+
+/**************** set_occupant ****************/
+/* Records in the occupancy index that the player in players[slot]
+ * is at pos, or with slot -1 that nobody is.
+ */
+void set_occupant(pos_t pos, int slot) {
+   if (slot < 0) {
+       intmap_remove(occupants, spot_key(pos));
+   } else {
+       intmap_set(occupants, spot_key(pos), slot);
    }
-   return NULL;
 }
 
 /**************** send_spectator_gold_message ****************/
@@ -448,42 +1226,38 @@ player_t* find_player_at_position(pos_t* pos) {
  * the total amount of uncollected gold remaining in the game.
  */
 void send_spectator_gold_message(addr_t spectator) {
-    // Allocate memory for the message
-    char* message = (char*)mem_malloc(64 * sizeof(char));
+    // Allocate scratch for the message
+    char* message = mem_arena_alloc(frame_arena, 64);
     // Format the message with the total uncollected gold
     snprintf(message, 64, "GOLD 0 0 %d", totalGold);
     message_send(spectator, message);
-    mem_free(message);
 }
 
 /**************** send_gold_message ****************/
 /* Sends a gold update message to the specified player.
  * The message includes the collected gold, the player's purse,
  * and the total uncollected gold remaining in the game.
- * Updates the spectator with the remaining gold as well.
  */
 void send_gold_message(player_t* player, int collected, int purse) {
-    // Allocate memory for the message
-    char* message = (char*)mem_malloc(64 * sizeof(char));
+    // Allocate scratch for the message
+    char* message = mem_arena_alloc(frame_arena, 64);
     // Format the message with collected, purse, and totalGold
     snprintf(message, 64, "GOLD %d %d %d", collected, purse, totalGold);
    message_send(get_player_address(player), message);
-   mem_free(message);
-   // Notify the spectator of the updated total gold (if present)
-   if (message_isAddr(spectator)) {
-       send_spectator_gold_message(spectator);
-   }
 }
 
-/**************** compare_players_by_score ****************/
-/* Comparator function for sorting players by their scores in descending order.
+/**************** compare_results_by_score ****************/
+/* Comparator function for sorting results by their scores in descending order.
  * Used with qsort to rank players at the end of the game.
  */
-int compare_players_by_score(const void* a, const void* b) {
-   player_t* playerA = *(player_t**)a;
-   player_t* playerB = *(player_t**)b;
-   // Compare players by score (higher scores first)
-   return get_player_score(playerB) - get_player_score(playerA);
+int compare_results_by_score(const void* a, const void* b) {
+   result_t* resultA = *(result_t**)a;
+   result_t* resultB = *(result_t**)b;
+   // Compare results by score (higher scores first), then by order of joining
+   if (resultA->score != resultB->score) {
+       return resultB->score - resultA->score;
+   }
+   return resultA->id - resultB->id;
 }
 
 /**************** add_player ****************/
@@ -492,7 +1266,7 @@ int compare_players_by_score(const void* a, const void* b) {
  * allocates memory for the new player, and sets their initial position on the grid.
  */
 player_t*
-add_player(char* name, addr_t* address, char letter)
+add_player(char* name, addr_t* address, const options_t* options)
 {
    // Check if the maximum number of players has been reached
     if (numPlayers >= MaxPlayers) {
@@ -500,35 +1274,37 @@ add_player(char* name, addr_t* address, char letter)
         return NULL;
     }
 
+    // Pick a random free room spot to start on
+    int x, y;
+    if (!grid_random_free(main_grid, &x, &y)) {
+        fprintf(stderr, "No free spot left for a new player.\n");
+        return NULL;
+    }
+
+    // Take a slot left by a player who quit, if any; the letter comes
+    // from the player's id, not the slot, so a quitting player's letter
+    // is not given to the next one (until the letters go round past 26)
+    int slot = numFreeSlots > 0 ? freeSlots[numFreeSlots - 1] : numSlots;
+    int id = nextPlayerId++;
+    char letter = 'A' + id % 26;
+
     // Create a new player structure
-    player_t* newPlayer = player_new(name, letter);
+    player_t* newPlayer = player_new_in(player_pool, name, letter,
+                                        grid_get_width(main_grid), grid_get_height(main_grid));
     if (newPlayer == NULL) {
         return NULL;
     }
     // Set the address of the player
     set_player_address(newPlayer, *address);
-
-    // Get the grid dimensions
-    int gridWidth = grid_get_width(main_grid);
-    int gridHeight = grid_get_height(main_grid);
-
-    // Generate a random starting position
-    int x = rand() % gridWidth;
-    int y = rand() % gridHeight;
-    pos_t* new_pos = position_new(x, y);
-
-    // Ensure the position is valid and unoccupied
-    while (grid_get_symbol(main_grid, new_pos) != '.') {
-        int x = rand() % gridWidth;
-        int y = rand() % gridHeight;
-        set_position_x(new_pos, x);
-        set_position_y(new_pos, y);
-    }
+    pos_t new_pos = position_at(x, y);
     
     // Set the player's position and update the grid
-    set_player_position_values(newPlayer, new_pos);
-    grid_set_symbol(main_grid, new_pos, letter);
-    position_delete(new_pos);
+    set_player_position(newPlayer, new_pos);
+    set_main_symbol(new_pos, letter);
+    set_occupant(new_pos, slot);
+
+    // Index the player by address
+    intmap_set(senders, address_key(*address), slot);
 
     // Send a confirmation message to the player
     char letter_message[5];
@@ -537,22 +1313,83 @@ add_player(char* name, addr_t* address, char letter)
     message_send(get_player_address(newPlayer), letter_message);
 
     // Add the new player to the players array
-    players[numPlayers++] = newPlayer;
+    if (numFreeSlots > 0) {
+        numFreeSlots--;
+    } else {
+        numSlots++;
+    }
+    players[slot] = newPlayer;
+    playerIds[slot] = id;
+    playerOptions[slot] = *options;
+    playerFrames[slot] = options->delta && !options->window ? frames_new() : NULL;
+    drawnBox[slot] = (box_t){ 0, 0, 0, 0 };
+    numPlayers++;
     return newPlayer;
 }
 
+/**************** remove_player ****************/
+/* Takes the player in players[slot] out of the game: records its
+ * result, clears its spot and its entries in the indexes, frees
+ * it, and leaves the slot for the next player to join.
+ */
+void
+remove_player(int slot)
+{
+    player_t* player = players[slot];
+    pos_t pos = get_player_position(player);
+    record_result(slot);
+    set_main_symbol(pos, grid_get_symbol(original_grid, pos));
+    set_occupant(pos, -1);
+    end_run(slot);
+    if (playerFrames[slot] != NULL) {
+        mem_pool_free(frames_pool, playerFrames[slot]);
+        playerFrames[slot] = NULL;
+    }
+    intmap_remove(senders, address_key(get_player_address(player)));
+    player_delete(player);
+    players[slot] = NULL;
+    freeSlots[numFreeSlots++] = slot;
+    numPlayers--;
+}
+
+/**************** record_result ****************/
+/* Records the id, score and name of the player in players[slot]
+ * for game_over.
+ */
+void
+record_result(int slot)
+{
+    player_t* player = players[slot];
+    char* name = get_player_name(player);
+    result_t* result = mem_arena_alloc(game_arena, sizeof(result_t) + strlen(name) + 1);
+    result->next = NULL;
+    result->score = get_player_score(player);
+    result->id = playerIds[slot];
+    strcpy(result->name, name);
+    *lastResult = result;
+    lastResult = &result->next;
+    numResults++;
+}
+
 /**************** get_player_by_address ****************/
-/* Finds a player by their address.
- * Searches through the list of players to find one 
- * whose address matches the provided address.
+/* Finds a player by their address, by looking it
+ * up in the senders index. Players who quit are no
+ * longer found.
  */
 player_t* get_player_by_address(addr_t* address) {
-    for (int i = 0; i < numPlayers; i++) {
-        if (players[i] != NULL && message_eqAddr(get_player_address(players[i]), *address)) {
-            return players[i];
-        }
+    int slot;
+    if (!intmap_find(senders, address_key(*address), &slot)) {
+        return NULL;
     }
-    return NULL;
+    return players[slot];
+}
+
+/**************** address_key ****************/
+/* Returns the key of an address in the senders index:
+ * the IPv4 address and the port, side by side.
+ */
+uint64_t address_key(addr_t address) {
+    return (uint64_t)ntohl(address.sin_addr.s_addr) << 16 | ntohs(address.sin_port);
 }
 
 /**************** setup_grid_with_gold ****************/
@@ -569,9 +1406,6 @@ setup_grid_with_gold(grid_t* grid)
     }
 
     int goldTrack = GoldTotal;
-    int gridWidth = grid_get_width(grid);
-    int gridHeight = grid_get_height(grid);
-    int** gold_grid = get_gold_grid(grid);
     // Generate random number of piles
     int numPiles = GoldMinNumPiles + rand() % (GoldMaxNumPiles - GoldMinNumPiles + 1);
 
@@ -587,24 +1421,19 @@ setup_grid_with_gold(grid_t* grid)
         goldTrack--;                            // Reduce remaining nuggets
     }
 
-    // Place the gold piles in valid room spots (`.`)
+    // Place the gold piles in random free room spots (`.`)
     for (int i = 0; i < numPiles; i++) {
-        bool placed = false;
-        pos_t* new_pos = position_new(-1, -1);
-        while (!placed) {
-            // Generate random coordinates within the grid
-            int x = rand() % gridWidth;
-            int y = rand() % gridHeight;
-            set_position_x(new_pos, x);
-            set_position_y(new_pos, y);
-            // Check if the spot is a valid room and unoccupied
-            if (grid_get_symbol(grid, new_pos) == '.' && gold_grid[y][x] == 0) {
-                grid_set_gold(grid, new_pos, distribution[i]);  // Place the gold pile here in gold_grid
-                grid_set_symbol(grid, new_pos, '*');
-                placed = true;
+        int x, y;
+        if (!grid_random_free(grid, &x, &y)) {
+            // no room left: the rest of the gold is not in play
+            fprintf(stderr, "No free spot left for gold; %d piles placed.\n", i);
+            for (int j = i; j < numPiles; j++) {
+                totalGold -= distribution[j];
             }
+            break;
         }
-        position_delete(new_pos);
+        grid_set_gold_at(grid, x, y, distribution[i]);  // Place the gold pile here
+        grid_set_symbol_at(grid, x, y, '*');
     }
 }
 
@@ -612,10 +1441,12 @@ setup_grid_with_gold(grid_t* grid)
 /* Converts a 2D grid array into a formatted string suitable 
  * for sending to clients via message_send
  * The function constructs the message to represent the current 
- * grid layout, ensuring valid dimensions.
+ * grid layout, ensuring valid dimensions. Each row is written at
+ * a fixed offset, into message if it is not NULL, or else into a
+ * new string from game_arena; either way the string is returned.
  */
 char*
-format_grid_message(grid_t* grid)
+format_grid_message(grid_t* grid, char* message)
 {
     if (grid == NULL) {
         fprintf(stderr, "Error: grid is NULL.\n");
@@ -631,31 +1462,21 @@ format_grid_message(grid_t* grid)
         return NULL;
     }
 
-        
-    char** main_grid = get_main_grid(grid);
-    if (main_grid == NULL) {
-        fprintf(stderr, "Error: main_grid is NULL.\n");
-        return NULL;
-    }
-
     // Calculate buffer size and allocate memory for the formatted message
-    int bufferSize = (width * height) + (height + 1) + strlen("DISPLAY\n") + 1;
-    char* message = mem_malloc(bufferSize);
-     // Initialize the buffer
-    message[0] = '\0';
-    strcat(message, "DISPLAY\n");
+    if (message == NULL) {
+        int bufferSize = (width * height) + (height + 1) + strlen("DISPLAY\n") + 1;
+        message = mem_arena_alloc(game_arena, bufferSize);
+    }
+    // Initialize the buffer
+    strcpy(message, "DISPLAY\n");
+    char* rows = message + strlen(message);
 
-    // Construct the grid message
+    // Compose the grid's rows into the message, one per line
+    grid_compose(grid, rows, width + 1);
     for (int i = 0; i < height; i++) {
-        if (main_grid[i] == NULL) {
-            fprintf(stderr, "Error: Row %d in main_grid is NULL.\n", i);
-            mem_free(message); // Free the allocated buffer
-            return NULL;
-        }
-        // Append the current row and a newline
-        strncat(message, main_grid[i], width);
-        strcat(message, "\n");
+        rows[i * (width + 1) + width] = '\n';
     }
+    rows[height * (width + 1)] = '\0';
     return message;
 }
 
@@ -664,7 +1485,7 @@ format_grid_message(grid_t* grid)
  * Sends a goodbye message and updates the game state accordingly.
  */
 void
-handle_quit(player_t* player, addr_t spectator, const addr_t* sender, bool isSpectator)
+handle_quit(player_t* player, const addr_t* sender, bool isSpectator)
 {
     // Determine the appropriate quit message
     const char* quit_message;
@@ -681,29 +1502,22 @@ handle_quit(player_t* player, addr_t spectator, const addr_t* sender, bool isSpe
     if (isSpectator) {
         // Reset the spectator address
         spectator = message_noAddr(); 
+        if (spectatorFrames != NULL) {
+            mem_pool_free(frames_pool, spectatorFrames);
+            spectatorFrames = NULL;
+        }
     }
     else {
-        if (player != NULL) {
-            // Restore the original grid symbol and invalidate player's position
-            grid_set_symbol(main_grid, get_player_position(player), grid_get_symbol(original_grid, get_player_position(player)));
-            set_position_x(get_player_position(player), -10);
-            player = NULL;
+        int slot;
+        if (player != NULL && intmap_find(senders, address_key(*sender), &slot)) {
+            // Take the player out of the game, keeping only its result
+            remove_player(slot);
             update_grid();
         }
     }
 }
 
 
-/**************** position_equal ****************/
-/* Checks if two positions are equal by comparing their coordinates.
- * Returns true if both positions have the same x and y values.
- */
-bool
-position_equal(pos_t* pos1, pos_t* pos2){
-   return get_position_x(pos1) == get_position_x(pos2) && get_position_y(pos1) == get_position_y(pos2);
-}
-
-
 /**************** sanitize_name ****************/
 /* Sanitizes the player's name input.
  * Copies and truncates the input, replaces characters
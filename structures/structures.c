@@ -1,17 +1,16 @@
 #include <stdio.h>
 #include <string.h>
-#include "../libcs50/set.h"
+#include <stdbool.h>
 #include "../libcs50/mem.h"
 #include "../support/message.h"
 #include "structures.h"
 
-/**************** global types ****************/
-/************* position *************/
-typedef struct position {
-  double x;
-  double y;
-  } pos_t;
+/**************** file-local constants ****************/
+#define LabelCount 26       // letters other players are shown as
+static const char DisplayHeader[] = "DISPLAY\n";
+static const int DisplayHeaderLength = sizeof(DisplayHeader) - 1;
 
+/**************** global types ****************/
 /************* line *************/
 typedef struct line {
   double m;
@@ -22,48 +21,109 @@ typedef struct line {
 typedef struct player {
   char* name;
   addr_t address;
-  pos_t* position;
+  pos_t position;
   char letter;
   int score;
-  set_t* viewed;
+  unsigned char* viewed;    // one bit per grid position, row by row
+  char* display;            // DISPLAY message: one line per grid row
+  pos_t view_position;      // where the display was last drawn from
+  int width;                // grid size the viewed bitmap and display cover
+  int height;
+  mem_pool_t* pool;         // where the player came from, or NULL for the heap
+  int label_id[LabelCount]; // id of the player shown as 'A' + i, or -1
+  int label_seen[LabelCount]; // frame it was last shown in
 } player_t;
 
+/************* intmap *************/
+/* Open addressing with linear probing; capacity is a power of
+ * two and kept at least twice the count, so probes stay short.
+ */
+typedef struct intmap_slot {
+  uint64_t key;
+  int value;
+  bool used;
+} intmap_slot_t;
+
+typedef struct intmap {
+  intmap_slot_t* slots;
+  int capacity;
+  int count;
+} intmap_t;
+
+/**************** local functions ****************/
+static int grid_index(player_t* player, int x, int y);
+static int intmap_home(intmap_t* map, uint64_t key);
+static int intmap_probe(intmap_t* map, uint64_t key);
+static void intmap_grow(intmap_t* map);
+
+/**************** player_size() ****************/
+/* see structures.h for description */
+size_t
+player_size(int width, int height, int name_length)
+{
+  return sizeof(player_t)
+    + ((size_t)width * height + 7) / 8 + 1          // viewed bitmap
+    + DisplayHeaderLength + (size_t)height * (width + 1) + 1  // display
+    + name_length + 1;
+}
+
 /**************** player_new() ****************/
 /* see structures.h for description */
 player_t*
-player_new(char* name, char letter)
+player_new(char* name, char letter, int width, int height)
+{
+  return player_new_in(NULL, name, letter, width, height);
+}
+
+/**************** player_new_in() ****************/
+/* see structures.h for description */
+player_t*
+player_new_in(mem_pool_t* pool, char* name, char letter, int width, int height)
 {
-  if (name == NULL || letter == '\0')
+  if (name == NULL || letter == '\0' || width < 0 || height < 0)
   {
     return NULL;
   }
-  player_t* player = mem_malloc(sizeof(player_t));
+  size_t size = player_size(width, height, strlen(name));
+  if (pool != NULL && size > mem_pool_size(pool)) {
+    return NULL;
+  }
+
+  // the player and its buffers share one block
+  player_t* player = pool != NULL ? mem_pool_alloc(pool) : mem_malloc(size);
   if (player == NULL) {
     return NULL;              
   } else {
-    player->name = mem_malloc(strlen(name) + 1);  
-    // Copy the name into the allocated memory
+    size_t viewed_size = ((size_t)width * height + 7) / 8 + 1;
+    size_t display_size = DisplayHeaderLength + (size_t)height * (width + 1) + 1;
+    player->pool = pool;
+    player->viewed = (unsigned char*)(player + 1);
+    player->display = (char*)player->viewed + viewed_size;
+    player->name = player->display + display_size;
+    // Copy the name into the block
     strcpy(player->name, name);
     player->letter = letter;
-    player->position = position_new(-1, -1);
+    player->position = position_at(-1, -1);
     player->score = 0;
-    player->viewed = set_new();
-    return player;
-  }
-}
+    player->width = width;
+    player->height = height;
+    memset(player->viewed, 0, viewed_size);
+    player->view_position = position_at(-1, -1);
+    for (int i = 0; i < LabelCount; i++) {
+      player->label_id[i] = -1;
+      player->label_seen[i] = 0;
+    }
 
-/**************** position_new() ****************/
-/* see structures.h for description */
-pos_t*
-position_new(double x, double y)
-{
-  pos_t* pos = mem_malloc(sizeof(pos_t));
-  if (pos == NULL) {
-    return NULL;              
+    // blank display, each row ending in a newline
+    strcpy(player->display, DisplayHeader);
+    char* row = player->display + DisplayHeaderLength;
+    for (int y = 0; y < height; y++, row += width + 1) {
+      memset(row, ' ', width);
+      row[width] = '\n';
+    }
+    *row = '\0';
+    return player;
   }
-  pos->x = x;
-  pos->y = y;
-  return pos;
 }
 
 /**************** line_new() ****************/
@@ -85,18 +145,11 @@ line_new(void)
 void 
 player_delete(player_t* player)
 {
-  mem_free(player->name);
-  position_delete(player->position);
-  set_delete(player->viewed, mem_free);
-  mem_free(player);
-}
-
-/**************** position_delete ****************/
-/* see structures.h for description */
-void 
-position_delete(pos_t* position)
-{
-  mem_free(position);
+  if (player != NULL && player->pool != NULL) {
+    mem_pool_free(player->pool, player);
+  } else {
+    mem_free(player);
+  }
 }
 
 /**************** line_delete ****************/
@@ -107,25 +160,6 @@ line_delete(line_t* line)
   mem_free(line);
 }
 
-/**************** create_key ****************/
-/* see structures.h for description */
-char*
-create_key(pos_t* pos)
-{
-    if (pos == NULL)
-    {
-        return NULL;
-    }
-    char* key = mem_malloc(50 * sizeof(char));
-    if (key == NULL) {
-    fprintf(stderr, "Failed to allocate memory for key");
-    exit(1);
-    }
-    // Format the key as a string "x_y"
-    sprintf(key, "%.6f_%.6f", (double) pos->x, (double) pos->y);
-    return key;
-}
-
 /**************** get_player_name ****************/
 /* see structures.h for description */
 char*
@@ -149,12 +183,12 @@ get_player_address(player_t* player)
 
 /**************** get_player_position ****************/
 /* see structures.h for description */
-pos_t*
+pos_t
 get_player_position(player_t* player)
 {
   if (player == NULL)
   {
-    return NULL;
+    return position_at(-1, -1);
   }
   return player->position;
 }
@@ -185,38 +219,51 @@ get_player_score(player_t* player)
 
 /**************** get_player_viewed ****************/
 /* see structures.h for description */
-set_t*
-get_player_viewed(player_t* player)
+bool
+get_player_viewed(player_t* player, int x, int y)
+{
+  int i = grid_index(player, x, y);
+  if (i < 0)
+  {
+    return false;
+  }
+  return (player->viewed[i / 8] >> (i % 8)) & 1;
+}
+
+/**************** get_player_display ****************/
+/* see structures.h for description */
+char*
+get_player_display(player_t* player)
 {
   if (player == NULL)
   {
     return NULL;
   }
-  return player->viewed;
+  return player->display;
 }
 
-/**************** get_position_x ****************/
+/**************** get_player_display_symbol ****************/
 /* see structures.h for description */
-double
-get_position_x(pos_t* pos)
+char
+get_player_display_symbol(player_t* player, int x, int y)
 {
-  if (pos == NULL)
+  if (grid_index(player, x, y) < 0)
   {
-    return -1;
+    return '\0';
   }
-  return pos->x;
+  return player->display[DisplayHeaderLength + y * (player->width + 1) + x];
 }
 
-/**************** get_position_y ****************/
+/**************** get_player_view_position ****************/
 /* see structures.h for description */
-double
-get_position_y(pos_t* pos)
+pos_t
+get_player_view_position(player_t* player)
 {
-  if (pos == NULL)
+  if (player == NULL)
   {
-    return -1;
+    return position_at(-1, -1);
   }
-  return pos->y;
+  return player->view_position;
 }
 
 /**************** get_line_slope ****************/
@@ -270,23 +317,66 @@ set_player_address(player_t* player, addr_t address_new)
 /**************** set_player_position ****************/
 /* see structures.h for description */
 void 
-set_player_position(player_t* player, pos_t* position_new)
+set_player_position(player_t* player, pos_t new_position)
+{
+  if (player != NULL)
+  {
+    player->position = new_position;
+  }
+}
+
+/**************** set_player_view_position ****************/
+/* see structures.h for description */
+void 
+set_player_view_position(player_t* player, pos_t new_position)
 {
-  if (player != NULL && position_new != NULL)
+  if (player != NULL)
   {
-    player->position = position_new;
+    player->view_position = new_position;
   }
 }
 
-/**************** set_player_position_values ****************/
+/**************** get_player_label ****************/
 /* see structures.h for description */
-void set_player_position_values(player_t* player, pos_t* position_new)
+char
+get_player_label(player_t* player, int id, int frame)
 {
-  if (player != NULL && position_new != NULL)
+  if (player == NULL || id < 0)
   {
-    set_position_x(get_player_position(player), get_position_x(position_new));
-    set_position_y(get_player_position(player), get_position_y(position_new));
+    return '\0';
+  }
+
+  // the id's own letter, or whichever letter it already has
+  int own = id % LabelCount;
+  int pick = -1;
+  if (player->label_id[own] == id) {
+    pick = own;
+  }
+  for (int i = 0; pick < 0 && i < LabelCount; i++) {
+    if (player->label_id[i] == id) {
+      pick = i;
+    }
   }
+
+  // otherwise its own letter if free, any free letter, or the stalest
+  if (pick < 0) {
+    if (player->label_id[own] < 0) {
+      pick = own;
+    } else {
+      for (int i = 0; i < LabelCount; i++) {
+        if (player->label_id[i] < 0) {
+          pick = i;
+          break;
+        }
+        if (pick < 0 || player->label_seen[i] < player->label_seen[pick]) {
+          pick = i;
+        }
+      }
+    }
+    player->label_id[pick] = id;
+  }
+  player->label_seen[pick] = frame;
+  return 'A' + pick;
 }
 
 /**************** set_player_letter ****************/
@@ -314,33 +404,23 @@ set_player_score(player_t* player, int score_new)
 /**************** set_player_viewed ****************/
 /* see structures.h for description */
 void 
-set_player_viewed(player_t* player, set_t* viewed_new)
+set_player_viewed(player_t* player, int x, int y)
 {
-  if (player != NULL && viewed_new != NULL)
+  int i = grid_index(player, x, y);
+  if (i >= 0)
   {
-    player->viewed = viewed_new;
+    player->viewed[i / 8] |= 1 << (i % 8);
   }
 }
 
-/**************** set_position_x ****************/
+/**************** set_player_display_symbol ****************/
 /* see structures.h for description */
 void 
-set_position_x(pos_t* pos, double x_new)
+set_player_display_symbol(player_t* player, int x, int y, char symbol)
 {
-  if (pos != NULL)
+  if (grid_index(player, x, y) >= 0 && symbol != '\0')
   {
-    pos->x = x_new;
-  }
-}
-
-/**************** set_position_y ****************/
-/* see structures.h for description */
-void 
-set_position_y(pos_t* pos, double y_new)
-{
-  if (pos != NULL)
-  {
-    pos->y = y_new;
+    player->display[DisplayHeaderLength + y * (player->width + 1) + x] = symbol;
   }
 }
 
@@ -364,4 +444,280 @@ set_line_intercept(line_t* line, double c_new)
   {
     line->c = c_new;
   }
-}
\ No newline at end of file
+}
+
+/**************** grid_index ****************/
+/* Returns the index of grid position (x,y) in the player's viewed bitmap,
+ * or -1 if the player is NULL or the position is off the grid.
+ */
+static int
+grid_index(player_t* player, int x, int y)
+{
+  if (player == NULL || x < 0 || y < 0 || x >= player->width || y >= player->height)
+  {
+    return -1;
+  }
+  return y * player->width + x;
+}
+
+/**************** intmap_new ****************/
+/* see structures.h for description */
+intmap_t*
+intmap_new(int expected)
+{
+  intmap_t* map = mem_malloc_assert(sizeof(intmap_t), "intmap");
+  map->capacity = 8;
+  while (map->capacity < 2 * expected) {
+    map->capacity *= 2;
+  }
+  map->slots = mem_calloc_assert(map->capacity, sizeof(intmap_slot_t), "intmap slots");
+  map->count = 0;
+  return map;
+}
+
+/**************** intmap_delete ****************/
+/* see structures.h for description */
+void
+intmap_delete(intmap_t* map)
+{
+  if (map != NULL) {
+    mem_free(map->slots);
+    mem_free(map);
+  }
+}
+
+/**************** intmap_find ****************/
+/* see structures.h for description */
+bool
+intmap_find(intmap_t* map, uint64_t key, int* value)
+{
+  if (map == NULL || map->count == 0) {
+    return false;
+  }
+  int i = intmap_probe(map, key);
+  if (!map->slots[i].used) {
+    return false;
+  }
+  if (value != NULL) {
+    *value = map->slots[i].value;
+  }
+  return true;
+}
+
+/**************** intmap_set ****************/
+/* see structures.h for description */
+void
+intmap_set(intmap_t* map, uint64_t key, int value)
+{
+  if (map == NULL) {
+    return;
+  }
+  int i = intmap_probe(map, key);
+  if (!map->slots[i].used) {
+    if (2 * (map->count + 1) > map->capacity) {
+      intmap_grow(map);
+      i = intmap_probe(map, key);
+    }
+    map->slots[i].used = true;
+    map->slots[i].key = key;
+    map->count++;
+  }
+  map->slots[i].value = value;
+}
+
+/**************** intmap_remove ****************/
+/* see structures.h for description */
+bool
+intmap_remove(intmap_t* map, uint64_t key)
+{
+  if (map == NULL || map->count == 0) {
+    return false;
+  }
+  int i = intmap_probe(map, key);
+  if (!map->slots[i].used) {
+    return false;
+  }
+  // shift later members of the run back so no probe meets a hole
+  int mask = map->capacity - 1;
+  int j = i;
+  while (true) {
+    map->slots[i].used = false;
+    int home;
+    do {
+      j = (j + 1) & mask;
+      if (!map->slots[j].used) {
+        map->count--;
+        return true;
+      }
+      home = intmap_home(map, map->slots[j].key);
+      // keep looking while slot j's home lies cyclically in (i, j]
+    } while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+    map->slots[i] = map->slots[j];
+    i = j;
+  }
+}
+
+/**************** intmap_count ****************/
+/* see structures.h for description */
+int
+intmap_count(intmap_t* map)
+{
+  return (map == NULL) ? 0 : map->count;
+}
+
+/**************** intmap_iterate ****************/
+/* see structures.h for description */
+void
+intmap_iterate(intmap_t* map, void* arg,
+               void (*itemfunc)(void* arg, uint64_t key, int value))
+{
+  if (map == NULL || itemfunc == NULL) {
+    return;
+  }
+  for (int i = 0; i < map->capacity; i++) {
+    if (map->slots[i].used) {
+      (*itemfunc)(arg, map->slots[i].key, map->slots[i].value);
+    }
+  }
+}
+
+/**************** intmap_home ****************/
+/* Returns the slot a key hashes to, mixing all 64 bits of the key.
+ */
+static int
+intmap_home(intmap_t* map, uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return (int)(key & (uint64_t)(map->capacity - 1));
+}
+
+/**************** intmap_probe ****************/
+/* Returns the slot holding the key, or the empty slot
+ * where it would go.
+ */
+static int
+intmap_probe(intmap_t* map, uint64_t key)
+{
+  int mask = map->capacity - 1;
+  int i = intmap_home(map, key);
+  while (map->slots[i].used && map->slots[i].key != key) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+/**************** intmap_grow ****************/
+/* Doubles the map's capacity and reinserts every key.
+ */
+static void
+intmap_grow(intmap_t* map)
+{
+  intmap_slot_t* old = map->slots;
+  int old_capacity = map->capacity;
+  map->capacity *= 2;
+  map->slots = mem_calloc_assert(map->capacity, sizeof(intmap_slot_t), "intmap slots");
+  for (int i = 0; i < old_capacity; i++) {
+    if (old[i].used) {
+      int j = intmap_probe(map, old[i].key);
+      map->slots[j] = old[i];
+    }
+  }
+  mem_free(old);
+}
+
+
+/* ****************************************************************** */
+/* ************************* UNIT_TEST ****************************** */
+/*
+ * This unit test exercises the intmap:
+ *   ./structurestest
+ * It grows a map well past its expected size, overwrites, removes
+ * every other key and checks the rest still probe correctly, then
+ * empties the map and fills it again without it growing.
+ * It exits with an assertion failure if anything is wrong.
+ */
+
+#ifdef UNIT_TEST
+
+#include <assert.h>
+
+#define Keys 5000
+
+/* Keys spaced so many share low bits, as socket addresses do. */
+static uint64_t
+test_key(int i)
+{
+  return ((uint64_t)i << 32) | 0x0100007f;
+}
+
+static void
+test_sum(void* arg, uint64_t key, int value)
+{
+  int* sum = arg;
+  assert(key == test_key(value / 2));
+  *sum += value;
+}
+
+int
+main(void)
+{
+  intmap_t* map = intmap_new(4);
+  int value;
+
+  // growth: far more keys than expected, all still found
+  for (int i = 0; i < Keys; i++) {
+    intmap_set(map, test_key(i), i);
+  }
+  assert(intmap_count(map) == Keys);
+  for (int i = 0; i < Keys; i++) {
+    assert(intmap_find(map, test_key(i), &value) && value == i);
+  }
+  assert(!intmap_find(map, test_key(Keys), NULL));
+  int capacity = map->capacity;
+  assert(capacity >= 2 * Keys);
+
+  // set overwrites without adding
+  for (int i = 0; i < Keys; i++) {
+    intmap_set(map, test_key(i), 2 * i);
+  }
+  assert(intmap_count(map) == Keys);
+  int sum = 0;
+  intmap_iterate(map, &sum, test_sum);
+  assert(sum == Keys * (Keys - 1));
+
+  // removal: every other key, leaving no holes in the others' runs
+  for (int i = 0; i < Keys; i += 2) {
+    assert(intmap_remove(map, test_key(i)));
+  }
+  assert(!intmap_remove(map, test_key(0)));
+  assert(intmap_count(map) == Keys / 2);
+  for (int i = 0; i < Keys; i++) {
+    bool found = intmap_find(map, test_key(i), &value);
+    assert(found == (i % 2 == 1));
+    assert(!found || value == 2 * i);
+  }
+
+  // clearing and reuse: empty it, then fill it again in place
+  for (int i = 1; i < Keys; i += 2) {
+    assert(intmap_remove(map, test_key(i)));
+  }
+  assert(intmap_count(map) == 0);
+  assert(!intmap_find(map, test_key(1), NULL));
+  for (int i = 0; i < Keys; i++) {
+    intmap_set(map, test_key(i), 2 * i);
+  }
+  assert(intmap_count(map) == Keys);
+  assert(map->capacity == capacity);
+  sum = 0;
+  intmap_iterate(map, &sum, test_sum);
+  assert(sum == Keys * (Keys - 1));
+
+  intmap_delete(map);
+  assert(mem_net() == 0);
+  printf("All tests passed.\n");
+  return 0;
+}
+
+#endif // UNIT_TEST
@@ -8,7 +8,8 @@
 #define __STRUCTURES
 
 #include <stdio.h>
-#include "../libcs50/set.h"
+#include <stdbool.h>
+#include <stdint.h>
 #include "../libcs50/mem.h"
 #include "../support/message.h"
 
@@ -21,7 +22,11 @@ typedef struct player player_t;  // opaque to users of the module
 
 /**************** global types ****************/
 /************* position *************/
-typedef struct position pos_t;
+/* A spot on the grid, column x and row y, passed by value. */
+typedef struct position {
+  int16_t x;
+  int16_t y;
+} pos_t;
 
 /************* line *************/
 typedef struct line line_t;
@@ -29,20 +34,83 @@ typedef struct line line_t;
 /************* player *************/
 typedef struct player player_t;
 
+/************* intmap *************/
+typedef struct intmap intmap_t;
+
 /**************** functions ****************/
 
+/**************** position_at ****************/
+/* Returns the position with column x and row y.
+ */
+static inline pos_t position_at(int x, int y)
+{
+  pos_t pos = { x, y };
+  return pos;
+}
+
+/**************** get_position_x ****************/
+/* Retrieves the x-coordinate (column) of a position.
+ */
+static inline int get_position_x(pos_t pos)
+{
+  return pos.x;
+}
+
+/**************** get_position_y ****************/
+/* Retrieves the y-coordinate (row) of a position.
+ */
+static inline int get_position_y(pos_t pos)
+{
+  return pos.y;
+}
+
+/**************** set_position_x ****************/
+/* Sets the x-coordinate (column) of a position.
+ */
+static inline void set_position_x(pos_t* pos, int x_new)
+{
+  pos->x = x_new;
+}
+
+/**************** set_position_y ****************/
+/* Sets the y-coordinate (row) of a position.
+ */
+static inline void set_position_y(pos_t* pos, int y_new)
+{
+  pos->y = y_new;
+}
+
+/**************** position_equal ****************/
+/* Checks whether two positions are the same spot.
+ */
+static inline bool position_equal(pos_t pos1, pos_t pos2)
+{
+  return pos1.x == pos2.x && pos1.y == pos2.y;
+}
+
 /**************** player_new() ****************/
-/* Creates a new player with the given name and letter.
+/* Creates a new player with the given name and letter, on a grid of the given size.
  * Allocates memory for the `player_t` structure and initializes its attributes,
- * including the name, letter, initial position, score, and the viewed set.
+ * including the name, letter, initial position, score, the viewed bitmap
+ * (one bit per grid position, none viewed yet) and a blank display.
+ */
+player_t* player_new(char* name, char letter, int width, int height);
+
+/**************** player_new_in() ****************/
+/* Like player_new, but takes the player from the given pool (see mem.h),
+ * or from the heap if pool is NULL. The player, its name, viewed bitmap
+ * and display share one block, so a pool of blocks of player_size bytes
+ * holds them all; returns NULL if the pool's blocks are too small.
+ * Players from a pool are released with the pool's arena, or one at a
+ * time by player_delete.
  */
-player_t* player_new(char* name, char letter);
+player_t* player_new_in(mem_pool_t* pool, char* name, char letter, int width, int height);
 
-/**************** position_new() ****************/
-/* Creates a new position with the given x and y coordinates.
- * Allocates memory for the `pos_t` structure and sets its coordinates.
+/**************** player_size() ****************/
+/* Returns the size of the block holding a player on a grid of the
+ * given size with a name of up to name_length characters.
  */
-pos_t* position_new(double x, double y);
+size_t player_size(int width, int height, int name_length);
 
 /**************** line_new() ****************/
 /* Creates a new line structure with default slope and intercept.
@@ -51,33 +119,16 @@ pos_t* position_new(double x, double y);
 line_t* line_new(void);
 
 /**************** player_delete ****************/
-/* Frees the memory associated with a player structure, including its name, position, and viewed set.
+/* Frees the memory associated with a player structure, including its name, viewed bitmap and display,
+ * returning it to its pool if it came from one.
  */
 void player_delete(player_t* item);
 
-/**************** position_delete ****************/
-/* Frees the memory associated with a position structure.
- */
-void position_delete(pos_t* item);
-
 /**************** line_delete ****************/
 /* Frees the memory associated with a line structure.
  */
 void line_delete(line_t* item);
 
-/**************** createKey ****************/
-/* Create a unique key for position structure.
- *
- * Caller provides:
- *   valid pointer to position structure.
- * We return:
- *   NULL if position is NULL
- *   char* key that is unique to the position
- * Notes:
- *   caller is responsible for freeing returned key.
- */
-char* create_key(pos_t* pos);
-
 /**************** get_player_name ****************/
 /* Retrieves the name of a player.
  * Returns a pointer to the player's name or NULL if the player is NULL.
@@ -90,21 +141,16 @@ char* get_player_name(player_t* player);
 void set_player_name(player_t* player, char* name_new);
 
 /**************** get_player_position ****************/
-/* Retrieves the position of a player.
- * Returns a pointer to the player's position or NULL if the player is NULL.
+/* Retrieves the position of a player, which is (-1,-1)
+ * until the player is placed or if the player is NULL.
  */
-pos_t* get_player_position(player_t* player);
+pos_t get_player_position(player_t* player);
 
 /**************** set_player_position ****************/
 /* Sets the position of a player.
  * Updates the player's position with the new position provided.
  */
-void set_player_position(player_t* player, pos_t* position_new);
-
-/**************** set_player_position_values ****************/
-/* Sets the x and y values of the player's position based on a new position.
- */
-void set_player_position_values(player_t* player, pos_t* position_new);
+void set_player_position(player_t* player, pos_t new_position);
 
 /**************** get_player_letter ****************/
 /* Retrieves the letter associated with a player.
@@ -144,40 +190,58 @@ addr_t get_player_address(player_t* player);
 void set_player_address(player_t* player, addr_t address_new);
 
 /**************** get_player_viewed ****************/
-/* Retrieves the set of viewed positions for a player.
- * Returns a pointer to the viewed set or NULL if the player is NULL.
+/* Checks whether the player has viewed grid position (x,y).
+ * Returns false if the player is NULL or the position is off the grid.
  */
-set_t* get_player_viewed(player_t* player);
+bool get_player_viewed(player_t* player, int x, int y);
 
 /**************** set_player_viewed ****************/
-/* Sets the set of viewed positions for a player.
- * Updates the player's viewed set with the new set provided.
+/* Records that the player has viewed grid position (x,y).
+ * Does nothing if the player is NULL or the position is off the grid.
  */
-void set_player_viewed(player_t* player, set_t* viewed_new);
+void set_player_viewed(player_t* player, int x, int y);
 
-/**************** get_position_x ****************/
-/* Retrieves the x-coordinate of a position.
- * Returns the x-coordinate or -1 if the position is NULL.
+/**************** get_player_display ****************/
+/* Retrieves the player's display, kept from one update to the next: a
+ * "DISPLAY\n" message followed by one line per grid row, ready to send.
+ * Returns NULL if the player is NULL.
  */
-double get_position_x(pos_t* pos);
+char* get_player_display(player_t* player);
 
-/**************** set_position_x ****************/
-/* Sets the x-coordinate of a position.
- * Updates the x-coordinate of the given position with the new value.
+/**************** get_player_display_symbol ****************/
+/* Retrieves the symbol at grid position (x,y) of the player's display.
+ * Returns '\0' if the player is NULL or the position is off the grid.
  */
-void set_position_x(pos_t* pos, double x_new);
+char get_player_display_symbol(player_t* player, int x, int y);
 
-/**************** get_position_y ****************/
-/* Retrieves the y-coordinate of a position.
- * Returns the y-coordinate or -1 if the position is NULL.
+/**************** set_player_display_symbol ****************/
+/* Sets the symbol at grid position (x,y) of the player's display.
+ * Does nothing if the player is NULL, the position is off the grid or the symbol is '\0'.
  */
-double get_position_y(pos_t* pos);
+void set_player_display_symbol(player_t* player, int x, int y, char symbol);
 
-/**************** set_position_y ****************/
-/* Sets the y-coordinate of a position.
- * Updates the y-coordinate of the given position with the new value.
+/**************** get_player_view_position ****************/
+/* Retrieves the position the player's display was last drawn from,
+ * which is (-1,-1) until it is first drawn or if the player is NULL.
  */
-void set_position_y(pos_t* pos, double y_new);
+pos_t get_player_view_position(player_t* player);
+
+/**************** set_player_view_position ****************/
+/* Records the position the player's display was last drawn from.
+ */
+void set_player_view_position(player_t* player, pos_t new_position);
+
+/**************** get_player_label ****************/
+/* Returns the letter the player sees the player with the given id as,
+ * assigning one on first sight: the id's own letter 'A' + id % 26 if
+ * the player has not given it to someone else, otherwise a letter not
+ * yet given out, otherwise the one the player has gone longest without
+ * seeing. frame is a count that advances with each display update, so
+ * a letter already shown in this update is only given out again when
+ * more than 26 players are in view. Returns '\0' if the player is NULL
+ * or id is negative.
+ */
+char get_player_label(player_t* player, int id, int frame);
 
 /**************** get_line_slope ****************/
 /* Retrieves the slope (m) of a line.
@@ -203,4 +267,45 @@ double get_line_intercept(line_t* line);
  */
 void set_line_intercept(line_t* line, double c_new);
 
+/**************** intmap_new ****************/
+/* Creates an empty map from 64-bit integer keys to int values,
+ * sized to hold about `expected` items before it first grows.
+ * The caller must later call intmap_delete.
+ */
+intmap_t* intmap_new(int expected);
+
+/**************** intmap_delete ****************/
+/* Frees the memory associated with an intmap.
+ */
+void intmap_delete(intmap_t* map);
+
+/**************** intmap_find ****************/
+/* Looks up a key. If it is present, stores its value in *value
+ * (when value is not NULL) and returns true; otherwise returns false.
+ */
+bool intmap_find(intmap_t* map, uint64_t key, int* value);
+
+/**************** intmap_set ****************/
+/* Sets the value for a key, adding the key if it is not present.
+ * Does nothing if the map is NULL.
+ */
+void intmap_set(intmap_t* map, uint64_t key, int value);
+
+/**************** intmap_remove ****************/
+/* Removes a key. Returns true if it was present.
+ */
+bool intmap_remove(intmap_t* map, uint64_t key);
+
+/**************** intmap_count ****************/
+/* Returns the number of keys in the map, or 0 if the map is NULL.
+ */
+int intmap_count(intmap_t* map);
+
+/**************** intmap_iterate ****************/
+/* Calls itemfunc(arg, key, value) once for each key in the map,
+ * in no particular order. The map must not change meanwhile.
+ */
+void intmap_iterate(intmap_t* map, void* arg,
+                    void (*itemfunc)(void* arg, uint64_t key, int value));
+
 #endif // __STRUCTURES
\ No newline at end of file
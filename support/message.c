@@ -12,6 +12,8 @@
  *
  */
 
+#define _GNU_SOURCE       // sendmmsg, recvmmsg
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -22,6 +24,8 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <math.h>
 #include "message.h"
 #include "log.h"
@@ -34,6 +38,15 @@
 static const int MinPort = 1024;
 static const int MaxPort = 65535;
 
+// Room for the messages queued between flushes of a batch
+#define MaxBatch 1024                   // messages; the most one sendmmsg takes
+#define MaxBatchPieces 4096             // pieces of those messages
+#define MaxBatchBytes 65536             // copies of the strings given to message_send
+
+// Room for the messages read from the socket in one go
+#define MaxReceive 64                   // messages
+#define MaxReceiveBytes 65536           // each; any UDP payload and its null
+
 /**************** file-local global variables ****************/
 /* This is an example of a judicious use of a global variable.
  * This module provides init() and done() functions that allow it
@@ -47,6 +60,48 @@ static const int MaxPort = 65535;
  */
 static int ourSocket = 0;     // socket on which to receive messages
 
+/* Messages queued while batching, to go out together at the next
+ * message_batch_flush. Pieces given to message_send_buf and
+ * message_sendv are queued as they are; strings given to
+ * message_send are copied to batchBytes.
+ */
+static bool batching = false;
+static struct mmsghdr batch[MaxBatch];
+static addr_t batchTo[MaxBatch];
+static int batchCount = 0;
+static struct iovec batchPieces[MaxBatchPieces];
+static int batchPieceCount = 0;
+static char batchBytes[MaxBatchBytes];
+static size_t batchByteCount = 0;
+
+/* Messages read from the socket by one recvmmsg, into buffers set
+ * aside once. message_loop hands them out in order, and reads again
+ * only when all are handled; a handler that ends the loop leaves the
+ * rest for the next call of message_loop.
+ */
+static char receiveBytes[MaxReceive][MaxReceiveBytes];
+static struct iovec receivePieces[MaxReceive];
+static struct mmsghdr receiveHeaders[MaxReceive];
+static addr_t receiveFrom[MaxReceive];
+static received_t received[MaxReceive];
+static int numReceived = 0;
+static int nextReceived = 0;
+
+static void batch_add(const addr_t to, const struct iovec* pieces, int count);
+static bool receive_all(void);
+static bool dispatch(void* arg,
+                     bool (*handleMessage)(void* arg,
+                                           const addr_t from, const char* buf),
+                     bool (*handleBatch)(void* arg,
+                                         const received_t* messages, int count));
+static bool loop(void* arg, const float timeout,
+                 bool (*handleTimeout)(void* arg),
+                 bool (*handleInput)  (void* arg),
+                 bool (*handleMessage)(void* arg,
+                                       const addr_t from, const char* buf),
+                 bool (*handleBatch)(void* arg,
+                                     const received_t* messages, int count));
+
 /***********************************************************************/
 /**************** message_init ****************/
 /* 
@@ -252,7 +307,26 @@ message_send(const addr_t to, const char* message)
     log_v("message_send: called with null message");
     return; // error in usage of this function.
   }
-  if (sendto(ourSocket, message, strlen(message), 0,
+  size_t length = strlen(message);
+  if (batching && length <= MaxBatchBytes) {
+    // queue a copy, since the caller may reuse its string at once
+    if (batchByteCount + length > MaxBatchBytes) {
+      message_batch_flush(NULL);
+    }
+    struct iovec piece = { batchBytes + batchByteCount, length };
+    memcpy(batchBytes + batchByteCount, message, length);
+    batchByteCount += length;
+    batch_add(to, &piece, 1);
+    log_s("message_send: queued TO %s", message_stringAddr(to));
+    log_d("message_send: %d lines:", numLines(message));
+    log_s("%s", message);
+    return;
+  }
+  if (batching) {
+    // too long to copy: send what is queued first, to keep the order
+    message_batch_flush(NULL);
+  }
+  if (sendto(ourSocket, message, length, 0,
              (struct sockaddr *) &to, sizeof(to)) < 0) {
     log_e("message_send: error sending to datagram socket");
   } else {
@@ -262,11 +336,154 @@ message_send(const addr_t to, const char* message)
   }
 }
 
+/**************** message_send_buf ****************/
+/* 
+ * Send a message of known length to the correspondent address.
+ * See message.h for detailed description.
+ */
+void
+message_send_buf(const addr_t to, const char* buf, size_t length)
+{
+  if (buf == NULL) {
+    log_v("message_send_buf: called with null message");
+    return; // error in usage of this function.
+  }
+  struct iovec piece = { (void*) buf, length };
+  message_sendv(to, &piece, 1);
+}
+
+/**************** message_sendv ****************/
+/* 
+ * Send a message gathered from pieces to the correspondent address.
+ * See message.h for detailed description.
+ */
+void
+message_sendv(const addr_t to, const struct iovec* pieces, int count)
+{
+  if (ourSocket == 0) {
+    log_v("message_sendv: called before message_init");
+    return; // error in usage of this function.
+  }
+  if (pieces == NULL || count < 0 || count > message_MaxPieces) {
+    log_d("message_sendv: called with bad pieces (count %d)", count);
+    return; // error in usage of this function.
+  }
+  if (batching) {
+    batch_add(to, pieces, count);
+    return;
+  }
+  struct msghdr header;
+  memset(&header, 0, sizeof(header));
+  header.msg_name = (void*) &to;
+  header.msg_namelen = sizeof(to);
+  header.msg_iov = (struct iovec*) pieces;
+  header.msg_iovlen = count;
+  ssize_t sent = sendmsg(ourSocket, &header, 0);
+  if (sent < 0) {
+    log_e("message_sendv: error sending to datagram socket");
+  } else {
+    log_s("message_sendv: TO %s", message_stringAddr(to));
+    log_d("message_sendv: %d bytes", (int) sent);
+  }
+}
+
+/**************** batch_add ****************/
+/* 
+ * Queue a message of count pieces for the next message_batch_flush,
+ * flushing first if the batch has no room for it.
+ */
+static void
+batch_add(const addr_t to, const struct iovec* pieces, int count)
+{
+  if (batchCount == MaxBatch || batchPieceCount + count > MaxBatchPieces) {
+    message_batch_flush(NULL);
+  }
+  struct msghdr* header = &batch[batchCount].msg_hdr;
+  memset(header, 0, sizeof(*header));
+  batchTo[batchCount] = to;
+  header->msg_name = &batchTo[batchCount];
+  header->msg_namelen = sizeof(addr_t);
+  header->msg_iov = &batchPieces[batchPieceCount];
+  header->msg_iovlen = count;
+  memcpy(&batchPieces[batchPieceCount], pieces, count * sizeof(struct iovec));
+  batchPieceCount += count;
+  batchCount++;
+}
+
+/**************** message_batch_begin ****************/
+/* 
+ * Start queueing messages rather than sending them.
+ * See message.h for detailed description.
+ */
+void
+message_batch_begin(void)
+{
+  batching = true;
+}
+
+/**************** message_batch_flush ****************/
+/* 
+ * Send the queued messages, as few sendmmsg calls as it takes.
+ * See message.h for detailed description.
+ */
+int
+message_batch_flush(int* failed)
+{
+  int sent = 0;       // messages sent
+  int errors = 0;     // messages that could not be sent
+  int calls = 0;      // sendmmsg calls
+  int next = 0;       // first message not yet tried
+  while (next < batchCount && ourSocket != 0) {
+    int n = sendmmsg(ourSocket, batch + next, batchCount - next, 0);
+    calls++;
+    if (n < 0) {
+      // the next message failed; skip it, and carry on with the rest
+      log_e("message_batch_flush: error sending to datagram socket");
+      errors++;
+      next++;
+      continue;
+    }
+    for (int i = next; i < next + n; i++) {
+      log_s("message_batch_flush: TO %s", message_stringAddr(batchTo[i]));
+      log_d("message_batch_flush: %d bytes", batch[i].msg_len);
+    }
+    sent += n;
+    next += n;
+  }
+  if (batchCount > 0) {
+    log_d("message_batch_flush: %d messages sent", sent);
+    log_d("message_batch_flush: %d sendmmsg calls", calls);
+    if (errors + sent < batchCount) {
+      errors = batchCount - sent;   // the socket was closed under us
+    }
+    if (errors > 0) {
+      log_d("message_batch_flush: %d messages failed", errors);
+    }
+  }
+  batchCount = 0;
+  batchPieceCount = 0;
+  batchByteCount = 0;
+  if (failed != NULL) {
+    *failed = errors;
+  }
+  return sent;
+}
+
+/**************** message_batch_end ****************/
+/* 
+ * Send the queued messages and stop queueing.
+ * See message.h for detailed description.
+ */
+void
+message_batch_end(void)
+{
+  message_batch_flush(NULL);
+  batching = false;
+}
+
 /**************** message_loop ****************/
 /* 
- * Loop forever, calling handler functions for stdin or socket,
- * as input is available from either.
- * Returns false on error or true if any of the handlers return true.
+ * loop, handling input and incoming messages, one at a time.
  * See message.h for detailed description.
  */
 bool
@@ -275,6 +492,47 @@ message_loop(void* arg, const float timeout,
              bool (*handleInput)  (void* arg),
              bool (*handleMessage)(void* arg,
                                    const addr_t from, const char* buf))
+{
+  if (handleTimeout == NULL && handleInput == NULL && handleMessage == NULL) {
+    log_v("message_loop called with all handlers null");
+    return false; // error in usage of this function.
+  }
+  return loop(arg, timeout, handleTimeout, handleInput, handleMessage, NULL);
+}
+
+/**************** message_loop_batch ****************/
+/* 
+ * loop, handling input and incoming messages, all that are waiting at once.
+ * See message.h for detailed description.
+ */
+bool
+message_loop_batch(void* arg, const float timeout,
+                   bool (*handleTimeout)(void* arg),
+                   bool (*handleInput)  (void* arg),
+                   bool (*handleBatch)(void* arg,
+                                       const received_t* messages, int count))
+{
+  if (handleTimeout == NULL && handleInput == NULL && handleBatch == NULL) {
+    log_v("message_loop_batch called with all handlers null");
+    return false; // error in usage of this function.
+  }
+  return loop(arg, timeout, handleTimeout, handleInput, NULL, handleBatch);
+}
+
+/**************** loop ****************/
+/* 
+ * The loop behind message_loop and message_loop_batch; one of
+ * handleMessage and handleBatch is NULL.
+ * Returns false on error or true if any of the handlers return true.
+ */
+static bool
+loop(void* arg, const float timeout,
+     bool (*handleTimeout)(void* arg),
+     bool (*handleInput)  (void* arg),
+     bool (*handleMessage)(void* arg,
+                           const addr_t from, const char* buf),
+     bool (*handleBatch)(void* arg,
+                         const received_t* messages, int count))
 {
   // check if we're ready for messaging
   if (ourSocket == 0) {
@@ -283,10 +541,6 @@ message_loop(void* arg, const float timeout,
   }
 
   // check parameters
-  if (handleTimeout == NULL && handleInput == NULL && handleMessage == NULL) {
-    log_v("message_loop called with all handlers null");
-    return false; // error in usage of this function.
-  }
   if (handleTimeout == NULL && timeout > 0.0) {
     log_v("message_loop called with null handleTimeout but timeout > 0");
     return false; // error in usage of this function.
@@ -295,6 +549,7 @@ message_loop(void* arg, const float timeout,
     log_v("message_loop called with Timeout handler but timeout <= 0");
     return false; // error in usage of this function.
   }
+  bool handlesMessages = handleMessage != NULL || handleBatch != NULL;
 
   // set up for timeouts, if desired
   struct timeval* timerp = NULL; // stays null if no timeout desired
@@ -302,7 +557,12 @@ message_loop(void* arg, const float timeout,
   struct timeval  timeoutval;     // timeval equivalent of parameter 'timeout'
   if (timeout > 0.0) {
     timeoutval.tv_sec  = (int)timeout;
-    timeoutval.tv_usec = timeout - (int)timeout;
+    timeoutval.tv_usec = (timeout - (int)timeout) * 1000000;
+  }
+
+  // messages left over by a handler that ended the last loop come first
+  if (handlesMessages && dispatch(arg, handleMessage, handleBatch)) {
+    return true;
   }
 
   // loop until error or some handler indicates time to quit looping
@@ -317,7 +577,7 @@ message_loop(void* arg, const float timeout,
       FD_SET(0, &rfds);       // monitor stdin
       nfds = 1;
     }
-    if (handleMessage != NULL && ourSocket != 0) {
+    if (handlesMessages && ourSocket != 0) {
       FD_SET(ourSocket, &rfds); // monitor the socket
       nfds = ourSocket+1;       // highest-numbered fd in rfds
     }
@@ -345,7 +605,9 @@ message_loop(void* arg, const float timeout,
     } else if (select_response == 0) {
       // timeout occurred
       log_v("message_loop: select() timed out");
-      if (handleTimeout != NULL && (*handleTimeout)(arg)) {
+      bool done = handleTimeout != NULL && (*handleTimeout)(arg);
+      message_batch_flush(NULL);
+      if (done) {
         break; // handler says to exit loop 
       }
     } else if (select_response > 0) {
@@ -354,38 +616,21 @@ message_loop(void* arg, const float timeout,
       if (FD_ISSET(0, &rfds)) {
         // stdin has input ready
         log_v("message_loop: input ready on stdin");
-        if (handleInput != NULL && (*handleInput)(arg)) {
+        bool done = handleInput != NULL && (*handleInput)(arg);
+        message_batch_flush(NULL);
+        if (done) {
           break; // handler says to exit loop 
         }
       }
       if (FD_ISSET(ourSocket, &rfds)) {
-        // socket has input ready
+        // socket has input ready: handle all that is waiting before
+        // sleeping again
         log_v("message_loop: message ready on socket");
-        struct sockaddr_in sender;     // sender of this message
-        struct sockaddr *senderp = (struct sockaddr *) &sender;
-        socklen_t senderlen = sizeof(sender);  // must pass address to length
-        char buf[message_MaxBytes]; // buffer for reading data from socket
-        int nbytes = recvfrom(ourSocket, buf, message_MaxBytes-1, 
-                              0, senderp, &senderlen);
-        if (nbytes < 0) {
-          // error, ignore it
-          log_e("message_loop: receiving from socket");
-        } else {
-          buf[nbytes] = '\0';     // null terminate message string
-          // where was it from?
-          if (sender.sin_family != AF_INET) {
-            // ignore it
-            log_d("message_loop: non-Internet family %d\n", sender.sin_family);
-          } else {
-	    // record it
-	    log_s("message_loop: FROM %s", message_stringAddr(sender));
-	    log_d("message_loop: %d lines:", numLines(buf));
-	    log_s("%s", buf);
-
-            // handle it
-            if (handleMessage != NULL && (*handleMessage)(arg, sender, buf)) {
-              break; // handler says to exit loop 
-            }
+        bool more = true;
+        while (more) {
+          more = receive_all();
+          if (dispatch(arg, handleMessage, handleBatch)) {
+            return true; // handler says to exit loop
           }
         }
       }
@@ -394,6 +639,84 @@ message_loop(void* arg, const float timeout,
   return true;
 }
 
+/**************** receive_all ****************/
+/* 
+ * Read the messages waiting on the socket, as many as fit, into
+ * received[]; there must be none left to hand out.
+ * Returns true if it filled every buffer, so more may be waiting.
+ */
+static bool
+receive_all(void)
+{
+  for (int i = 0; i < MaxReceive; i++) {
+    receivePieces[i] = (struct iovec){ receiveBytes[i], MaxReceiveBytes-1 };
+    receiveHeaders[i].msg_hdr = (struct msghdr){
+      .msg_name = &receiveFrom[i], .msg_namelen = sizeof(addr_t),
+      .msg_iov = &receivePieces[i], .msg_iovlen = 1 };
+  }
+  numReceived = nextReceived = 0;
+
+  int count = recvmmsg(ourSocket, receiveHeaders, MaxReceive, MSG_DONTWAIT, NULL);
+  if (count < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      // error, ignore it
+      log_e("message_loop: receiving from socket");
+    }
+    return false;
+  }
+  log_d("message_loop: %d messages received", count);
+
+  for (int i = 0; i < count; i++) {
+    char* buf = receiveBytes[i];
+    buf[receiveHeaders[i].msg_len] = '\0'; // null terminate message string
+    addr_t sender = receiveFrom[i];
+    // where was it from?
+    if (sender.sin_family != AF_INET) {
+      // ignore it
+      log_d("message_loop: non-Internet family %d\n", sender.sin_family);
+    } else {
+      // record it
+      log_s("message_loop: FROM %s", message_stringAddr(sender));
+      log_d("message_loop: %d lines:", numLines(buf));
+      log_s("%s", buf);
+      received[numReceived++] = (received_t){ sender, buf };
+    }
+  }
+  return count == MaxReceive;
+}
+
+/**************** dispatch ****************/
+/* 
+ * Hand out the received messages not yet handled: all at once to
+ * handleBatch, if given, or else one by one to handleMessage, sending
+ * what each handler queued when it returns.
+ * Returns true if a handler says to exit the loop.
+ */
+static bool
+dispatch(void* arg,
+         bool (*handleMessage)(void* arg,
+                               const addr_t from, const char* buf),
+         bool (*handleBatch)(void* arg,
+                             const received_t* messages, int count))
+{
+  while (nextReceived < numReceived) {
+    bool done;
+    if (handleBatch != NULL) {
+      int first = nextReceived;
+      nextReceived = numReceived;
+      done = (*handleBatch)(arg, &received[first], numReceived - first);
+    } else {
+      received_t* message = &received[nextReceived++];
+      done = handleMessage != NULL && (*handleMessage)(arg, message->from, message->buf);
+    }
+    message_batch_flush(NULL);
+    if (done) {
+      return true; // handler says to exit loop 
+    }
+  }
+  return false;
+}
+
 /**************** message_done ****************/
 /* 
  * Clean up the message module, prior to exit.
@@ -402,6 +725,8 @@ message_loop(void* arg, const float timeout,
 void
 message_done(void)
 {
+  message_batch_end();
+  numReceived = nextReceived = 0;
   if (ourSocket != 0) {
     close(ourSocket);
     ourSocket = 0;
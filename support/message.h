@@ -15,6 +15,13 @@
  *   message_send(serverAddress, message); // client speaks first
  *   message_loop(arg, timeout, handleTimeout, handleStdin, handleMessage);
  *   message_done();
+ * A server answering each message with many others can queue them,
+ * to go out together when the handler returns, by calling
+ *   message_batch_begin();
+ * before message_loop. A server that would rather see all the messages
+ * waiting at once, to answer them together, calls
+ *   message_loop_batch(arg, timeout, handleTimeout, handleStdin, handleBatch);
+ * in place of message_loop.
  * Note:
  *  handleTimeout may be NULL (and timeout==0) if no timers needed.
  *  handleInput may be NULL if no input expected.
@@ -29,6 +36,7 @@
 #include <stdbool.h>
 #include <arpa/inet.h>  // These two includes are not needed for this file, 
 #include <sys/select.h> // but is needed for users of this file.
+#include <sys/uio.h>    // struct iovec, for message_sendv
 
 /****************** types *********************/
 /* A type representing an Internet address, suitable for use in message_send().
@@ -44,11 +52,22 @@
  */
 typedef struct sockaddr_in addr_t;
 
+/* A message as message_loop_batch hands it to its handler: the address
+ * it came from, and its contents as a string.
+ */
+typedef struct received {
+  addr_t from;
+  const char* buf;
+} received_t;
+
 /****************** constants *********************/
 // Maximum payload size for UDP messages, according to
 // https://en.wikipedia.org/wiki/User_Datagram_Protocol
 static const int message_MaxBytes = 65507;
 
+// Most pieces message_sendv gathers into one message (IOV_MAX on Linux)
+static const int message_MaxPieces = 1024;
+
 /****************** global functions *********************/
 
 /******************************************/
@@ -132,6 +151,71 @@ const char* message_stringAddr(const addr_t addr);
  */
 void message_send(const addr_t to, const char* message);
 
+/******************************************/
+/* message_send_buf: send a message of known length.
+ * Caller provides:
+ *   a valid address to which to send the message,
+ *   the message, which need not be null-terminated,
+ *   its length in bytes.
+ * Function returns: none
+ * Assumptions: message_init() has already been called.
+ * Logs:
+ *   errors in arguments,
+ *   errors in sending the message,
+ *   the address and length of the message, but not its content.
+ */
+void message_send_buf(const addr_t to, const char* buf, size_t length);
+
+/******************************************/
+/* message_sendv: send one message gathered from several pieces,
+ * without copying them together first.
+ * Caller provides:
+ *   a valid address to which to send the message,
+ *   an array of count pieces, each a start and a length,
+ *   which are sent one after another as a single message;
+ *   count is at most message_MaxPieces.
+ * Function returns: none
+ * Assumptions: message_init() has already been called.
+ * Logs:
+ *   errors in arguments,
+ *   errors in sending the message,
+ *   the address and length of the message, but not its content.
+ */
+void message_sendv(const addr_t to, const struct iovec* pieces, int count);
+
+/******************************************/
+/* message_batch_begin: start queueing messages.
+ * From now on message_send, message_send_buf and message_sendv queue
+ * their message rather than send it; message_batch_flush sends all
+ * that are queued together, with as few system calls as it can.
+ * message_loop flushes after every handler returns.
+ * Caller expectations:
+ *   strings given to message_send are copied, but the buffers given
+ *   to message_send_buf and message_sendv are sent from where they
+ *   are, so must stay unchanged until the next flush.
+ * Logs: nothing.
+ */
+void message_batch_begin(void);
+
+/******************************************/
+/* message_batch_flush: send the queued messages.
+ * Caller provides:
+ *   a pointer to an int for the number of messages that could not
+ *   be sent, or NULL.
+ * Function returns:
+ *   the number of messages sent; none are left queued.
+ * Logs:
+ *   the address and length of each message sent,
+ *   how many were sent, in how many system calls, and how many failed.
+ */
+int message_batch_flush(int* failed);
+
+/******************************************/
+/* message_batch_end: send the queued messages, and stop queueing.
+ * Logs: as message_batch_flush.
+ */
+void message_batch_end(void);
+
 /******************************************/
 /* message_loop: loop, handling input and incoming messages.
  * Caller provides:
@@ -153,6 +237,10 @@ void message_send(const addr_t to, const char* message);
  *   Handlers should return true to terminate looping, false to keep looping.
  * Notes:
  *   The timeout feature is optional; use timeout=0 and handleTimeout=NULL.
+ *   All the messages waiting on the socket are read at once (with
+ *   recvmmsg) and handled before the loop waits again; those still
+ *   unhandled when a handler ends the loop are handled first by the
+ *   next call of message_loop or message_loop_batch.
  * Logs:
  *   errors in arguments,
  *   errors in monitoring stdin and/or network,
@@ -165,6 +253,29 @@ bool message_loop(void* arg, const float timeout,
                                         const addr_t from, 
                                         const char* message));
 
+/******************************************/
+/* message_loop_batch: loop, handling input and incoming messages,
+ * all those waiting at once.
+ * Caller provides:
+ *   as for message_loop, but a function for handling a batch of
+ *   inbound messages (may be NULL) in place of handleMessage.
+ * Function returns: as message_loop.
+ * Handlers:
+ *   handleBatch: provided an array of count messages, in the order
+ *     they arrived, each with its address and contents: all that were
+ *     waiting on the socket, up to the number read at once (it is called
+ *     again for the rest). The handler should realize the memory of the
+ *     array and its strings will be reused upon return from the handler.
+ *   handleTimeout and handleInput: as for message_loop.
+ * Logs: as message_loop.
+ */
+bool message_loop_batch(void* arg, const float timeout,
+                        bool (*handleTimeout)(void* arg),
+                        bool (*handleInput)  (void* arg),
+                        bool (*handleBatch)(void* arg,
+                                            const received_t* messages,
+                                            int count));
+
 /******************************************/
 /* message_done: shut down the module.
  * Caller provides: nothing.
@@ -172,6 +283,7 @@ bool message_loop(void* arg, const float timeout,
  * Assumptions: 
  *   message_init() had been called earlier.
  *   no message() functions will be called later.
+ * Queued messages are sent first.
  * Logs: a note indicating close down of message module.
  */
 void message_done(void);
@@ -9,20 +9,440 @@
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
-#include "../libcs50/set.h"
+#include <stdint.h>
 #include "vision.h"
 
 
 /**************** Global Variables ****************/
 const int radius = 5;
 
+/**************** global types ****************/
+typedef struct visibility {
+  grid_t* base;         // base map the table was built from
+  int width;            // map width (no terminator)
+  int height;           // map height
+  int noffsets;         // number of spots within the vision radius
+  int* disk;            // (2*radius+1)^2 window -> offset index, or -1 if outside radius
+  signed char* offset;  // offset index -> dx, dy (2 per offset)
+  int nwords;           // 32-bit words per bitset
+  int nslots;           // number of bitsets
+  int* slot;            // per map spot: index of its bitset, or -1 if not room/passage
+  uint32_t* bits;       // nwords per slot, one bit per offset index
+  bool packed;          // slot and bits are the base grid's compiled data
+  int* ray_start;       // per offset index: first step of its ray template (noffsets+1 entries)
+  signed char* ray;     // ray template steps, 4 per step: ax, ay, bx, by
+} visibility_t;
+
+/* start of packed visibility data (see visibility_pack); the
+ * slot array and then the bitsets follow */
+typedef struct packed {
+  int32_t kernel;       // PackedKernel of the build that packed it
+  int32_t radius;
+  int32_t noffsets;
+  int32_t width;
+  int32_t height;
+  int32_t nslots;
+} packed_t;
+
+#ifdef LEGACY_LOS
+static const int32_t PackedKernel = 1;
+#else
+static const int32_t PackedKernel = 2;
+#endif
+
+/* where a ray starts, for testing steps against a grid */
+typedef struct origin {
+  grid_t* grid;
+  int x;
+  int y;
+} origin_t;
+
+/* where the next template step is written */
+typedef struct cursor {
+  signed char* next;
+} cursor_t;
+
+/**************** local functions ****************/
+static int disk_index(visibility_t* vis, int dx, int dy);
+static int floor_div(int a, int b);
+static bool ray_walk(int dx, int dy, bool (*visit)(void* arg, int ax, int ay, int bx, int by), void* arg);
+static bool step_clear(void* arg, int ax, int ay, int bx, int by);
+static bool step_record(void* arg, int ax, int ay, int bx, int by);
+static bool unpack_bits(visibility_t* vis, grid_t* base_grid, const void* data, size_t size);
+static void build_bits(visibility_t* vis, grid_t* base_grid);
+#ifndef LEGACY_LOS
+static bool ray_clear(visibility_t* vis, grid_t* grid, int k, int x, int y);
+#endif
+
+
+/**************** visibility_new ****************/
+/* see vision.h for description */
+
+visibility_t* visibility_new(grid_t* base_grid)
+{
+  if (base_grid == NULL) {
+    return NULL;
+  }
+  visibility_t* vis = mem_malloc_assert(sizeof(visibility_t), "visibility_new");
+  vis->base = base_grid;
+  vis->width = grid_get_width(base_grid) - 1;
+  vis->height = grid_get_height(base_grid) - 1;
+
+  // numbers every offset within the radius, row by row
+  int side = 2 * radius + 1;
+  vis->disk = mem_malloc_assert(side * side * sizeof(int), "visibility disk");
+  vis->offset = mem_malloc_assert(2 * side * side, "visibility offsets");
+  vis->noffsets = 0;
+  for (int dy = -radius; dy <= radius; dy++) {
+    for (int dx = -radius; dx <= radius; dx++) {
+      if (dx * dx + dy * dy <= radius * radius) {
+        vis->offset[2 * vis->noffsets] = dx;
+        vis->offset[2 * vis->noffsets + 1] = dy;
+        vis->disk[(dy + radius) * side + (dx + radius)] = vis->noffsets++;
+      } else {
+        vis->disk[(dy + radius) * side + (dx + radius)] = -1;
+      }
+    }
+  }
+  vis->nwords = (vis->noffsets + 31) / 32;
+
+  // records the ray template for every offset; a ray to (dx,dy)
+  // has one step per column and one per row strictly between the ends
+  vis->ray_start = mem_malloc_assert((vis->noffsets + 1) * sizeof(int), "visibility rays");
+  int nsteps = 0;
+  for (int dy = -radius; dy <= radius; dy++) {
+    for (int dx = -radius; dx <= radius; dx++) {
+      int k = disk_index(vis, dx, dy);
+      if (k >= 0) {
+        vis->ray_start[k] = nsteps;
+        nsteps += (dx != 0 ? abs(dx) - 1 : 0) + (dy != 0 ? abs(dy) - 1 : 0);
+      }
+    }
+  }
+  vis->ray_start[vis->noffsets] = nsteps;
+  vis->ray = mem_malloc_assert(4 * nsteps + 1, "visibility ray steps");
+  for (int dy = -radius; dy <= radius; dy++) {
+    for (int dx = -radius; dx <= radius; dx++) {
+      int k = disk_index(vis, dx, dy);
+      if (k >= 0) {
+        cursor_t cursor = { vis->ray + 4 * vis->ray_start[k] };
+        ray_walk(dx, dy, step_record, &cursor);
+      }
+    }
+  }
+
+  // takes the bitsets from a compiled map if it has them
+  size_t size;
+  const void* data = grid_get_visibility_data(base_grid, &size);
+  if (!unpack_bits(vis, base_grid, data, size)) {
+    build_bits(vis, base_grid);
+  }
+  return vis;
+}
+
+
+/**************** visibility_pack ****************/
+/* see vision.h for description */
+
+void* visibility_pack(visibility_t* vis, size_t* size)
+{
+  if (vis == NULL) {
+    *size = 0;
+    return NULL;
+  }
+  packed_t header = { PackedKernel, radius, vis->noffsets, vis->width, vis->height, vis->nslots };
+  size_t slot_size = (size_t)vis->width * vis->height * sizeof(int32_t);
+  size_t bits_size = (size_t)vis->nslots * vis->nwords * sizeof(uint32_t);
+  *size = sizeof(header) + slot_size + bits_size;
+  char* data = mem_malloc_assert(*size, "visibility_pack");
+  memcpy(data, &header, sizeof(header));
+  memcpy(data + sizeof(header), vis->slot, slot_size);
+  memcpy(data + sizeof(header) + slot_size, vis->bits, bits_size);
+  return data;
+}
+
+
+/**************** unpack_bits ****************/
+/* Points the table's slots and bitsets at packed data, if it
+ * was packed by this build for a map of this size, with a slot
+ * for each walkable spot of base_grid numbered as build_bits
+ * would, so no slot can index past the bitsets. Returns false,
+ * changing nothing, if there is no such data.
+ */
+static bool unpack_bits(visibility_t* vis, grid_t* base_grid, const void* data, size_t size)
+{
+  const packed_t* header = data;
+  if (data == NULL || size < sizeof(*header)
+      || header->kernel != PackedKernel || header->radius != radius
+      || header->noffsets != vis->noffsets
+      || header->width != vis->width || header->height != vis->height
+      || header->nslots < 0) {
+    return false;
+  }
+  size_t slot_size = (size_t)vis->width * vis->height * sizeof(int32_t);
+  size_t bits_size = (size_t)header->nslots * vis->nwords * sizeof(uint32_t);
+  if (size != sizeof(*header) + slot_size + bits_size) {
+    return false;
+  }
+  const int32_t* slot = (const int32_t*)((const char*)data + sizeof(*header));
+  int nslots = 0;
+  for (int y = 0; y < vis->height; y++) {
+    for (int x = 0; x < vis->width; x++) {
+      bool walkable = grid_get_class_at(base_grid, x, y) & GridWalkable;
+      if (slot[y * vis->width + x] != (walkable ? nslots++ : -1)) {
+        fprintf(stderr, "visibility: packed slots do not match the map; computing them instead\n");
+        return false;
+      }
+    }
+  }
+  if (nslots != header->nslots) {
+    fprintf(stderr, "visibility: packed slots do not match the map; computing them instead\n");
+    return false;
+  }
+  vis->nslots = header->nslots;
+  vis->slot = (int*)((char*)data + sizeof(*header));
+  vis->bits = (uint32_t*)((char*)data + sizeof(*header) + slot_size);
+  vis->packed = true;
+  return true;
+}
+
+
+/**************** build_bits ****************/
+/* Computes the table's slots and bitsets from the base map.
+ */
+static void build_bits(visibility_t* vis, grid_t* base_grid)
+{
+  // gives every spot a player can stand on its own bitset
+  int ncells = vis->width * vis->height;
+  int nslots = 0;
+  vis->slot = mem_malloc_assert(ncells * sizeof(int), "visibility slots");
+  for (int y = 0; y < vis->height; y++) {
+    for (int x = 0; x < vis->width; x++) {
+      bool walkable = grid_get_class_at(base_grid, x, y) & GridWalkable;
+      vis->slot[y * vis->width + x] = walkable ? nslots++ : -1;
+    }
+  }
+  vis->bits = mem_calloc_assert(nslots * vis->nwords + 1, sizeof(uint32_t), "visibility bits");
+  vis->nslots = nslots;
+  vis->packed = false;
+
+  // fills each bitset using the line-of-sight rules on the base map
+  for (int y = 0; y < vis->height; y++) {
+    for (int x = 0; x < vis->width; x++) {
+      int slot = vis->slot[y * vis->width + x];
+      if (slot < 0) {
+        continue;
+      }
+      uint32_t* bits = vis->bits + slot * vis->nwords;
+#ifndef LEGACY_LOS
+      // passage corners cannot be seen from a passage
+      bool passage = grid_get_class_at(base_grid, x, y) & GridPassage;
+#endif
+      for (int dy = -radius; dy <= radius; dy++) {
+        for (int dx = -radius; dx <= radius; dx++) {
+          int k = disk_index(vis, dx, dy);
+          if (k < 0 || x + dx < 0 || y + dy < 0 || x + dx >= vis->width || y + dy >= vis->height) {
+            continue;
+          }
+#ifdef LEGACY_LOS
+          bool visible = check_visible_legacy(base_grid, position_at(x + dx, y + dy), position_at(x, y));
+#else
+          bool visible = !(passage && dx != 0 && dy != 0) && ray_clear(vis, base_grid, k, x, y);
+#endif
+          if (visible) {
+            bits[k / 32] |= (uint32_t)1 << (k % 32);
+          }
+        }
+      }
+    }
+  }
+}
+
+
+/**************** visibility_delete ****************/
+/* see vision.h for description */
+
+void visibility_delete(visibility_t* vis)
+{
+  if (vis != NULL) {
+    mem_free(vis->disk);
+    mem_free(vis->offset);
+    if (!vis->packed) {
+      mem_free(vis->slot);
+      mem_free(vis->bits);
+    }
+    mem_free(vis->ray_start);
+    mem_free(vis->ray);
+    mem_free(vis);
+  }
+}
+
+
+/**************** visibility_check ****************/
+/* see vision.h for description */
+
+bool visibility_check(visibility_t* vis, pos_t from, pos_t to)
+{
+  if (vis == NULL) {
+    return false;
+  }
+  int fx = get_position_x(from);
+  int fy = get_position_y(from);
+  if (fx < 0 || fy < 0 || fx >= vis->width || fy >= vis->height) {
+    return false;
+  }
+  int slot = vis->slot[fy * vis->width + fx];
+  int k = disk_index(vis, get_position_x(to) - fx, get_position_y(to) - fy);
+  if (slot < 0 || k < 0) {
+    return false;
+  }
+  return (vis->bits[slot * vis->nwords + k / 32] >> (k % 32)) & 1;
+}
+
+
+/**************** visibility_get_radius ****************/
+/* see vision.h for description */
+
+int visibility_get_radius(visibility_t* vis)
+{
+  return vis == NULL ? 0 : radius;
+}
+
+
+/**************** disk_index ****************/
+/* Returns the offset index of (dx,dy) within the vision
+ * radius, or -1 if it lies outside the radius.
+ */
+
+static int disk_index(visibility_t* vis, int dx, int dy)
+{
+  if (dx < -radius || dx > radius || dy < -radius || dy > radius) {
+    return -1;
+  }
+  return vis->disk[(dy + radius) * (2 * radius + 1) + (dx + radius)];
+}
+
+
+/**************** floor_div ****************/
+/* Divides a by b > 0, rounding toward negative infinity.
+ */
+
+static int floor_div(int a, int b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+
+/**************** ray_walk ****************/
+/* Visits the steps of the line of sight from (0,0) to (dx,dy),
+ * as in the Requirements Spec: for each column and each row strictly
+ * between the ends, either the spot the line crosses exactly (when
+ * a == b) or the pair of spots a and b it passes between. Uses exact
+ * integer arithmetic. Stops and returns false when visit does.
+ */
+
+static bool ray_walk(int dx, int dy, bool (*visit)(void* arg, int ax, int ay, int bx, int by), void* arg)
+{
+  int adx = abs(dx);
+  int ady = abs(dy);
+
+  // each column between the ends: the line is at row dy*i/adx
+  for (int i = 1; i < adx; i++) {
+    int x = dx < 0 ? -i : i;
+    int y = floor_div(dy * i, adx);
+    int next = (dy * i) % adx == 0 ? y : y + 1;
+    if (!visit(arg, x, y, x, next)) {
+      return false;
+    }
+  }
+
+  // each row between the ends: the line is at column dx*j/ady
+  for (int j = 1; j < ady; j++) {
+    int y = dy < 0 ? -j : j;
+    int x = floor_div(dx * j, ady);
+    int next = (dx * j) % ady == 0 ? x : x + 1;
+    if (!visit(arg, x, y, next, y)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/**************** step_clear ****************/
+/* Checks that a ray step from the origin does not block vision,
+ * meaning the line crosses or passes next to a room spot.
+ */
+
+static bool step_clear(void* arg, int ax, int ay, int bx, int by)
+{
+  origin_t* origin = arg;
+  return grid_in_room_at(origin->grid, origin->x + ax, origin->y + ay)
+    || grid_in_room_at(origin->grid, origin->x + bx, origin->y + by);
+}
+
+
+/**************** step_record ****************/
+/* Appends a ray step to a ray template.
+ */
+
+static bool step_record(void* arg, int ax, int ay, int bx, int by)
+{
+  cursor_t* cursor = arg;
+  cursor->next[0] = ax;
+  cursor->next[1] = ay;
+  cursor->next[2] = bx;
+  cursor->next[3] = by;
+  cursor->next += 4;
+  return true;
+}
+
+
+#ifndef LEGACY_LOS
+/**************** ray_clear ****************/
+/* Runs the ray template for offset index k from spot (x,y);
+ * returns true if no step blocks vision.
+ */
+
+static bool ray_clear(visibility_t* vis, grid_t* grid, int k, int x, int y)
+{
+  signed char* step = vis->ray + 4 * vis->ray_start[k];
+  signed char* end = vis->ray + 4 * vis->ray_start[k + 1];
+  for (; step < end; step += 4) {
+    if (!grid_in_room_at(grid, x + step[0], y + step[1])
+        && !grid_in_room_at(grid, x + step[2], y + step[3])) {
+      return false;
+    }
+  }
+  return true;
+}
+#endif
+
+
+/**************** check_visible ****************/
+/* see vision.h for description */
+
+bool check_visible(grid_t* main_grid, pos_t pos1, pos_t pos2)
+{
+  origin_t origin = { main_grid, get_position_x(pos2), get_position_y(pos2) };
+  int dx = get_position_x(pos1) - origin.x;
+  int dy = get_position_y(pos1) - origin.y;
+
+  // ensures passage corners cannot be seen
+  if (dx != 0 && dy != 0 && (grid_get_class_at(main_grid, origin.x, origin.y) & GridPassage)) {
+    return false;
+  }
+  return ray_walk(dx, dy, step_clear, &origin);
+}
+
+#ifdef LEGACY_LOS
 /**************** calc_line ****************/
 /* see vision.h for description */
 
-line_t* calc_line(pos_t* pos1, pos_t* pos2)
+line_t* calc_line(double x1, double y1, double x2, double y2)
 {
-  double m = (get_position_y(pos2) - get_position_y(pos1) )/(get_position_x(pos2)  - get_position_x(pos1));
-  double c = (get_position_y(pos1) - m * get_position_x(pos1));
+  double m = (y2 - y1) / (x2 - x1);
+  double c = (y1 - m * x1);
 
   line_t* line = line_new();
   set_line_slope(line, m);
@@ -34,66 +454,49 @@ line_t* calc_line(pos_t* pos1, pos_t* pos2)
 /**************** is_inside_vert ****************/
 /* see vision.h for description */
 
-bool is_inside_vert(grid_t* main_grid, pos_t* pos)
+bool is_inside_vert(grid_t* main_grid, double x, double y)
 {
-  // if the position has integer y value
-  if ((int)get_position_y(pos) == get_position_y(pos)) {
-    return grid_in_room(main_grid, pos);
+  // if the point has integer y value
+  if ((int)y == y) {
+    return grid_in_room_at(main_grid, (int)x, (int)y);
   }
 
-  // calculates the integer y positions directly above and below
-  double y_ceil = ceil(get_position_y(pos));
-  double y_floor = floor(get_position_y(pos));
-  pos_t* up = position_new(get_position_x(pos), y_ceil);
-  pos_t* down = position_new(get_position_x(pos), y_floor);
-
-  // evaluates and cleans up
-  bool inside = grid_in_room(main_grid, up) || grid_in_room(main_grid, down);
-  position_delete(up);
-  position_delete(down);
-
-  return inside;
+  // checks the integer y positions directly above and below
+  return grid_in_room_at(main_grid, (int)x, (int)ceil(y))
+    || grid_in_room_at(main_grid, (int)x, (int)floor(y));
 }
 
 
 /**************** is_inside_horiz ****************/
 /* see vision.h for description */
 
-bool is_inside_horiz(grid_t* main_grid, pos_t* pos)
+bool is_inside_horiz(grid_t* main_grid, double x, double y)
 {
-  // if the position has integer x value
-  if ((int)get_position_x(pos) == get_position_x(pos)) {
-    return grid_in_room(main_grid, pos);
+  // if the point has integer x value
+  if ((int)x == x) {
+    return grid_in_room_at(main_grid, (int)x, (int)y);
   }
 
-  // calculates the integer x positions directly left and right
-  double x_ceil = ceil(get_position_x(pos));
-  double x_floor = floor(get_position_x(pos));
-  pos_t* right = position_new(x_ceil, get_position_y(pos));
-  pos_t* left = position_new(x_floor, get_position_y(pos));
-
-  // evaluates and cleans up
-  bool inside = grid_in_room(main_grid, right) || grid_in_room(main_grid, left);
-  position_delete(right);
-  position_delete(left);
-
-  return inside;
+  // checks the integer x positions directly left and right
+  return grid_in_room_at(main_grid, (int)ceil(x), (int)y)
+    || grid_in_room_at(main_grid, (int)floor(x), (int)y);
 }
 
 
-/**************** check_visible ****************/
+/**************** check_visible_legacy ****************/
 /* see vision.h for description */
 
-bool check_visible(grid_t* main_grid, pos_t* pos1, pos_t* pos2)
+bool check_visible_legacy(grid_t* main_grid, pos_t pos1, pos_t pos2)
 {
   // initializes data structures
   double x;
   double y;
-  pos_t* left;
-  pos_t* right;
-  pos_t* up;
-  pos_t* down;
-  line_t* line = calc_line(pos1, pos2);
+  pos_t left;
+  pos_t right;
+  pos_t up;
+  pos_t down;
+  line_t* line = calc_line(get_position_x(pos1), get_position_y(pos1),
+                           get_position_x(pos2), get_position_y(pos2));
 
   // ensures passage corners cannot be seen 
   if (grid_get_symbol(main_grid, pos2) == '#' && get_line_slope(line) != 0 && isfinite(get_line_slope(line))) {
@@ -115,15 +518,12 @@ bool check_visible(grid_t* main_grid, pos_t* pos1, pos_t* pos2)
     // loops over the x positions
     for (x = (get_position_x(left)) + 1; x < get_position_x(right); x++) {
       y = get_line_slope(line) * x + get_line_intercept(line);
-      pos_t* pos = position_new(x, y);
 
       // if the line of vision runs outside the room
-      if (!is_inside_vert(main_grid, pos)) {
-        position_delete(pos);
+      if (!is_inside_vert(main_grid, x, y)) {
         line_delete(line);
         return false;
       }
-      position_delete(pos);
     }
   }
 
@@ -147,67 +547,64 @@ bool check_visible(grid_t* main_grid, pos_t* pos1, pos_t* pos2)
       } else {
         x = (y - get_line_intercept(line)) / get_line_slope(line);
       }
-      pos_t* pos = position_new(x, y);
 
       // if the line of vision runs outside the room
-      if (!is_inside_horiz(main_grid, pos)) {
-        position_delete(pos);
+      if (!is_inside_horiz(main_grid, x, y)) {
         line_delete(line);
         return false;
       }
-      position_delete(pos);
     }
   }
   // clean up and return
   line_delete(line);
   return true;
   }
+#endif // LEGACY_LOS
 
 
 /**************** calc_grid ****************/
 /* see vision.h for description */
 
-grid_t* calc_grid(grid_t* main_grid, player_t* player)
+void calc_grid(grid_t* main_grid, visibility_t* vis, player_t* player,
+               char (*label)(void* arg, player_t* viewer, int x, int y, char symbol),
+               void* arg)
 {
   // initializes data structures
-  pos_t* player_pos = get_player_position(player);
-  set_t* viewed = get_player_viewed(player);
-  grid_t* perspective_grid = make_grid_blank(grid_get_width(main_grid), grid_get_height(main_grid));
-
-
-  // loops over all positions in the grid
-  for (int x = 0; x < grid_get_width(main_grid); x++) {
-    for (int y = 0; y < grid_get_height(main_grid); y++) {
-      pos_t* temp_pos = position_new((double)x, (double)y);
-
-      // if the position is the player position
-      if (get_position_x(temp_pos) == get_position_x(player_pos) && get_position_y(temp_pos) == get_position_y(player_pos)) {
-        grid_set_symbol(perspective_grid, temp_pos, '@');
-        position_delete(temp_pos);
-        continue;
-      }
-
-      // if temp_ps further than 'radius' away from player_pos, skip it 
-      if (pow(get_position_x(player_pos) - get_position_x(temp_pos), 2) + 
-        pow(get_position_y(player_pos) - get_position_y(temp_pos), 2) > 
-        pow(radius, 2)) {
-        position_delete(temp_pos);
-        continue;
-        }
+  pos_t player_pos = get_player_position(player);
+  pos_t view_pos = get_player_view_position(player);
+  int px = get_position_x(player_pos);
+  int py = get_position_y(player_pos);
+  int vx = get_position_x(view_pos);
+  int vy = get_position_y(view_pos);
+
+  // spots seen from the last view go back to what the player remembers
+  for (int k = 0; k < vis->noffsets; k++) {
+    int x = vx + vis->offset[2 * k];
+    int y = vy + vis->offset[2 * k + 1];
+    if (get_player_viewed(player, x, y)) {
+      set_player_display_symbol(player, x, y, grid_get_symbol_at(vis->base, x, y));
+    } else {
+      set_player_display_symbol(player, x, y, ' ');
+    }
+  }
 
-      char* key = create_key(temp_pos);
-      if (set_find(viewed, key) != NULL) {  // if the position has already been viewed
-        grid_set_symbol(perspective_grid, temp_pos, grid_get_symbol(main_grid, temp_pos));
-        position_delete(temp_pos);
-      } else if (check_visible(main_grid, temp_pos, player_pos)) {  // if the position is viewable
-        set_insert(viewed, key, temp_pos);
-        grid_set_symbol(perspective_grid, temp_pos, grid_get_symbol(main_grid, temp_pos));
-      } else {  // unviewable position--do nothing
-        position_delete(temp_pos);
+  // spots visible from here show their occupants too
+  int slot = -1;
+  if (px >= 0 && py >= 0 && px < vis->width && py < vis->height) {
+    slot = vis->slot[py * vis->width + px];
+  }
+  for (int k = 0; slot >= 0 && k < vis->noffsets; k++) {
+    if ((vis->bits[slot * vis->nwords + k / 32] >> (k % 32)) & 1) {
+      int x = px + vis->offset[2 * k];
+      int y = py + vis->offset[2 * k + 1];
+      set_player_viewed(player, x, y);
+      char symbol = grid_get_symbol_at(main_grid, x, y);
+      if (label != NULL && symbol != grid_get_symbol_at(vis->base, x, y)) {
+        symbol = label(arg, player, x, y, symbol);
       }
-      mem_free(key);
+      set_player_display_symbol(player, x, y, symbol);
     }
   }
-  // return the final grid
-  return perspective_grid;
-}
\ No newline at end of file
+  set_player_display_symbol(player, px, py, '@');
+  set_player_view_position(player, player_pos);
+}
@@ -8,32 +8,96 @@
 #include <stdbool.h>
 #include "../grid/grid.h"
 
-/* Calculates the equation of the line running
- * through two given positions
+/**************** global types ****************/
+typedef struct visibility visibility_t;  // opaque to users of the module
+
+
+/* Builds the visibility table for a map: for every
+ * room or passage spot, a bitset of the spots within
+ * the vision radius that can be seen from it. Built
+ * once from the unchanging base map, which must
+ * outlive the table; caller must later call
+ * visibility_delete. If the base map was loaded
+ * compiled with matching data (see visibility_pack),
+ * the bitsets are used from there, not built; data
+ * whose slots do not match the map is noted on stderr
+ * and built instead.
+ */
+visibility_t* visibility_new(grid_t* base_grid);
+
+
+/* Packs the table's bitsets for grid_write_compiled,
+ * storing the size in *size. Caller must free the
+ * result with mem_free.
+ */
+void* visibility_pack(visibility_t* vis, size_t* size);
+
+
+/* Frees the visibility table
+ */
+void visibility_delete(visibility_t* vis);
+
+
+/* Looks up whether the spot 'to' is visible from the
+ * spot 'from' in the visibility table. Returns false
+ * if 'from' is not a room or passage spot or 'to' is
+ * outside the vision radius.
  */
-grid_t* calc_grid(grid_t* main_grid, player_t* player);
+bool visibility_check(visibility_t* vis, pos_t from, pos_t to);
 
 
-/* Checks whether a given position is inside
- * the room with respect to the vertical axis
+/* Returns the vision radius the table was built for
  */
-bool is_inside_vert(grid_t* main_grid, pos_t* pos);
+int visibility_get_radius(visibility_t* vis);
 
 
-/* Checks whether a given position is inside
- * the room with respect to the horizontal axis
+/* Updates the player's display in place: spots
+ * visible within the vision radius show their
+ * occupants from main_grid, other spots the player
+ * has viewed show the base map, and the player is '@'.
+ * Only the spots within the radius of the player's
+ * current and last drawn positions are touched.
+ * If label is not NULL, each visible occupant is
+ * drawn as label(arg, player, x, y, symbol) returns,
+ * so that viewers can see the same occupant differently.
  */
-bool is_inside_horiz(grid_t* main_grid, pos_t* pos);
+void calc_grid(grid_t* main_grid, visibility_t* vis, player_t* player,
+               char (*label)(void* arg, player_t* viewer, int x, int y, char symbol),
+               void* arg);
 
 
 /* Checks whether two positions on a grid are 
- * visible from each other. Assumes that both
- * positions are inside the room.
+ * visible from each other, looking from pos2 toward
+ * pos1. Walks the line of sight with exact integer
+ * arithmetic and allocates no memory.
+ */
+bool check_visible(grid_t* main_grid, pos_t pos1, pos_t pos2);
+
+
+#ifdef LEGACY_LOS
+/* The original floating-point line-of-sight kernel,
+ * built with -DLEGACY_LOS so it can be compared with
+ * check_visible; the visibility table then uses it too.
  */
-bool check_visible(grid_t* main_grid, pos_t* pos1, pos_t* pos2);
+bool check_visible_legacy(grid_t* main_grid, pos_t pos1, pos_t pos2);
+
 
+/* Checks whether the point (x,y), which may lie
+ * between spots, is inside the room with respect
+ * to the vertical axis
+ */
+bool is_inside_vert(grid_t* main_grid, double x, double y);
 
-/* Calculates the visible grid
- * for a given player
+
+/* Checks whether the point (x,y), which may lie
+ * between spots, is inside the room with respect
+ * to the horizontal axis
+ */
+bool is_inside_horiz(grid_t* main_grid, double x, double y);
+
+
+/* Calculates the equation of the line running
+ * through the points (x1,y1) and (x2,y2)
  */
-line_t* calc_line(pos_t* pos1, pos_t* pos2);
\ No newline at end of file
+line_t* calc_line(double x1, double y1, double x2, double y2);
+#endif // LEGACY_LOS
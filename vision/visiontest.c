@@ -17,10 +17,17 @@ static const int numMoves = 8; // number of moves for test_calc_grid()
 
 
 /*********** Function prototypes ***********/
+#ifdef LEGACY_LOS
 void test_calc_line();
 void test_is_inside_vert();
 void test_is_inside_horiz();
+void test_legacy_kernel(char* map);
+#endif
 void test_check_visible();
+void test_visibility();
+void test_compiled();
+void test_remembered();
+void test_labels();
 void test_calc_grid();
 
 
@@ -30,10 +37,20 @@ void test_calc_grid();
 int main() {
     printf("Running tests for vision functions...\n");
 
+#ifdef LEGACY_LOS
     test_calc_line();
     test_is_inside_vert();
     test_is_inside_horiz();
+    test_legacy_kernel("../maps/main.txt");
+    test_legacy_kernel("../maps/hole.txt");
+    test_legacy_kernel("../maps/big.txt");
+    test_legacy_kernel("../maps/challenge.txt");
+#endif
     test_check_visible();
+    test_visibility();
+    test_compiled();
+    test_remembered();
+    test_labels();
     test_calc_grid();
 
     printf("All tests passed.\n");
@@ -41,22 +58,19 @@ int main() {
 }
 
 
+#ifdef LEGACY_LOS
 /**************** test_calc_line ****************/
 /* Tests calc_line */
 
 void test_calc_line() {
   // initializes data structures
-  pos_t* pos1 = position_new(1,1);
-  pos_t* pos2 = position_new(3,3);
-  line_t* line = calc_line(pos1, pos2);
+  line_t* line = calc_line(1, 1, 3, 3);
 
   // asserts
   assert(get_line_slope(line) == 1.0);
   assert(get_line_intercept(line) == 0.0);
 
   // cleans up
-  position_delete(pos1);
-  position_delete(pos2);
   line_delete(line);
   printf("test_calc_line passed.\n");
 }
@@ -68,16 +82,12 @@ void test_calc_line() {
 void test_is_inside_vert() {
   // initializes data structures
   grid_t* grid = grid_new("../maps/main.txt");
-  pos_t* pos_inside = position_new(9, 2.2);
-  pos_t* pos_outside = position_new(2,2.5);
 
   // asserts
-  assert(is_inside_vert(grid, pos_inside) == true);
-  assert(is_inside_vert(grid, pos_outside) == false);
+  assert(is_inside_vert(grid, 9, 2.2) == true);
+  assert(is_inside_vert(grid, 2, 2.5) == false);
   
   // cleans up
-  position_delete(pos_inside);
-  position_delete(pos_outside);
   grid_delete(grid);
   printf("test_is_inside_vert passed.\n");
 }
@@ -89,44 +99,252 @@ void test_is_inside_vert() {
 void test_is_inside_horiz() {
   // initializes data structures
   grid_t* grid = grid_new("../maps/main.txt");
-  pos_t* pos_inside = position_new(62, 15.5);
-  pos_t* pos_outside = position_new(4.4, 4);
 
   // asserts
-  assert(is_inside_horiz(grid, pos_outside) == false);
-  assert(is_inside_horiz(grid, pos_inside) == true);
+  assert(is_inside_horiz(grid, 4.4, 4) == false);
+  assert(is_inside_horiz(grid, 62, 15.5) == true);
 
   // cleans up
-  position_delete(pos_inside);
-  position_delete(pos_outside);
   grid_delete(grid);
   printf("test_is_inside_horiz passed.\n");
   
 }
 
 
+/**************** test_legacy_kernel ****************/
+/* Compares check_visible with check_visible_legacy
+ * for every room or passage spot in a map and every
+ * spot within the vision radius of it */
+
+void test_legacy_kernel(char* map) {
+  // initializes data structures
+  grid_t* grid = grid_new(map);
+  pos_t from;
+  pos_t to;
+  int range = 5;
+  int differ = 0;
+
+  // counts the pairs on which the kernels disagree
+  for (int y = 0; y < grid_get_height(grid); y++) {
+    for (int x = 0; x < grid_get_width(grid); x++) {
+      from = position_at(x, y);
+      if (!grid_is_inside(grid, from) || !grid_valid_position(grid, from)) {
+        continue;
+      }
+      for (int dy = -range; dy <= range; dy++) {
+        for (int dx = -range; dx <= range; dx++) {
+          to = position_at(x + dx, y + dy);
+          if (check_visible(grid, to, from) != check_visible_legacy(grid, to, from)) {
+            printf("%s: (%d,%d) -> (%d,%d) differs\n", map, x, y, x + dx, y + dy);
+            differ++;
+          }
+        }
+      }
+    }
+  }
+  assert(differ == 0);
+
+  // cleans up
+  grid_delete(grid);
+  printf("test_legacy_kernel %s passed.\n", map);
+}
+#endif // LEGACY_LOS
+
+
 /**************** test_check_visible ****************/
 /* Tests check_visible */
 
 void test_check_visible() {
   // initializes data structures
   grid_t* grid = grid_new("../maps/main.txt");
-  pos_t* pos1 = position_new(5.0,1.0);
-  pos_t* pos2 = position_new(11.0,1.0);
-  pos_t* pos3 = position_new(5,10);
+  pos_t pos1 = position_at(5, 1);
+  pos_t pos2 = position_at(11, 1);
+  pos_t pos3 = position_at(5, 10);
 
   // asserts
   assert(check_visible(grid, pos1, pos2) == true);
   assert(check_visible(grid, pos1, pos3) == false);
 
-  position_delete(pos1);
-  position_delete(pos2);
-  position_delete(pos3);
   grid_delete(grid);
   printf("test_check_visible passed.\n");
 }
 
 
+/**************** test_visibility ****************/
+/* Tests that the visibility table agrees with
+ * check_visible for every room or passage spot
+ * and every spot within the vision radius */
+
+void test_visibility() {
+  // initializes data structures
+  grid_t* grid = grid_new("../maps/main.txt");
+  visibility_t* vis = visibility_new(grid);
+  pos_t from;
+  pos_t to;
+  int range = 5;
+
+  // asserts
+  for (int y = 0; y < grid_get_height(grid); y++) {
+    for (int x = 0; x < grid_get_width(grid); x++) {
+      from = position_at(x, y);
+      if (!grid_is_inside(grid, from) || !grid_valid_position(grid, from)) {
+        continue;
+      }
+      for (int dy = -range; dy <= range; dy++) {
+        for (int dx = -range; dx <= range; dx++) {
+          to = position_at(x + dx, y + dy);
+          bool expected = dx * dx + dy * dy <= range * range 
+            && grid_is_inside(grid, to) && check_visible(grid, to, from);
+          assert(visibility_check(vis, from, to) == expected);
+        }
+      }
+    }
+  }
+
+  // cleans up
+  visibility_delete(vis);
+  grid_delete(grid);
+  printf("test_visibility passed.\n");
+}
+
+
+/**************** test_compiled ****************/
+/* Tests that a map compiled with its visibility table
+ * loads with the same symbols and table, and that the
+ * loader falls back to the text map when there is no
+ * compiled file */
+
+void test_compiled() {
+  // initializes data structures
+  char* compiled = "visiontest.mapc";
+  grid_t* grid = grid_new("../maps/main.txt");
+  visibility_t* vis = visibility_new(grid);
+  size_t size;
+  void* data = visibility_pack(vis, &size);
+  assert(grid_write_compiled(grid, "../maps/main.txt", compiled, data, size));
+  grid_t* loaded = grid_load_compiled(compiled, "../maps/main.txt");
+  visibility_t* loaded_vis = visibility_new(loaded);
+  pos_t from;
+  pos_t to;
+  int range = visibility_get_radius(vis);
+
+  // asserts
+  assert(grid_get_visibility_data(loaded, &size) != NULL);
+  assert(grid_get_width(loaded) == grid_get_width(grid));
+  assert(grid_get_height(loaded) == grid_get_height(grid));
+  for (int y = 0; y < grid_get_height(grid); y++) {
+    for (int x = 0; x < grid_get_width(grid); x++) {
+      assert(grid_get_symbol_at(loaded, x, y) == grid_get_symbol_at(grid, x, y));
+      from = position_at(x, y);
+      for (int dy = -range; dy <= range; dy++) {
+        for (int dx = -range; dx <= range; dx++) {
+          to = position_at(x + dx, y + dy);
+          assert(visibility_check(loaded_vis, from, to) == visibility_check(vis, from, to));
+        }
+      }
+    }
+  }
+  remove(compiled);
+  grid_t* fallback = grid_load_compiled(compiled, "../maps/main.txt");
+  assert(fallback != NULL && grid_get_visibility_data(fallback, &size) == NULL);
+
+  // cleans up
+  mem_free(data);
+  visibility_delete(loaded_vis);
+  visibility_delete(vis);
+  grid_delete(fallback);
+  grid_delete(loaded);
+  grid_delete(grid);
+  printf("test_compiled passed.\n");
+}
+
+
+/**************** test_remembered ****************/
+/* Tests that calc_grid shows occupants only of visible
+ * spots, and the base map for spots viewed earlier */
+
+void test_remembered() {
+  // initializes data structures
+  grid_t* base_grid = grid_new("../maps/main.txt");
+  grid_t* main_grid = grid_new("../maps/main.txt");
+  visibility_t* vis = visibility_new(base_grid);
+  player_t* player = player_new("testplayer", 'T',
+                                grid_get_width(main_grid), grid_get_height(main_grid));
+  grid_set_symbol(main_grid, position_at(7, 2), '*');
+
+  // sees the gold next to it
+  set_player_position(player, position_at(8, 2));
+  calc_grid(main_grid, vis, player, NULL, NULL);
+  assert(get_player_display_symbol(player, 7, 2) == '*');
+  assert(get_player_display_symbol(player, 8, 2) == '@');
+
+  // moves to another room; remembers the spot but not the gold
+  set_player_position(player, position_at(20, 13));
+  calc_grid(main_grid, vis, player, NULL, NULL);
+  assert(get_player_display_symbol(player, 7, 2) == '.');
+  assert(get_player_display_symbol(player, 8, 2) == '.');
+  assert(get_player_display_symbol(player, 30, 18) == ' ');
+  assert(get_player_display_symbol(player, 20, 13) == '@');
+
+  // cleans up
+  player_delete(player);
+  visibility_delete(vis);
+  grid_delete(main_grid);
+  grid_delete(base_grid);
+  printf("test_remembered passed.\n");
+}
+
+
+/**************** label_by_id ****************/
+/* A calc_grid label function for test_labels: the occupant
+ * of (7,2) has player id 27, that of (9,2) player id 1 */
+
+static char label_by_id(void* arg, player_t* viewer, int x, int y, char symbol) {
+  int* frame = arg;
+  if (y == 2 && (x == 7 || x == 9)) {
+    return get_player_label(viewer, x == 7 ? 27 : 1, *frame);
+  }
+  return symbol;
+}
+
+
+/**************** test_labels ****************/
+/* Tests that calc_grid draws occupants as the label function
+ * says, and that each viewer keeps the letters it gave out */
+
+void test_labels() {
+  // initializes data structures
+  grid_t* base_grid = grid_new("../maps/main.txt");
+  grid_t* main_grid = grid_new_layer(base_grid);
+  visibility_t* vis = visibility_new(base_grid);
+  player_t* player = player_new("testplayer", 'T',
+                                grid_get_width(main_grid), grid_get_height(main_grid));
+  int frame = 1;
+  grid_set_symbol(main_grid, position_at(7, 2), 'B');
+  grid_set_symbol(main_grid, position_at(9, 2), 'B');
+
+  // id 27 gets its own letter 'B', so id 1 gets the first free one
+  set_player_position(player, position_at(8, 2));
+  calc_grid(main_grid, vis, player, label_by_id, &frame);
+  assert(get_player_display_symbol(player, 7, 2) == 'B');
+  assert(get_player_display_symbol(player, 9, 2) == 'A');
+
+  // the letters stay with the ids
+  frame++;
+  calc_grid(main_grid, vis, player, label_by_id, &frame);
+  assert(get_player_display_symbol(player, 7, 2) == 'B');
+  assert(get_player_display_symbol(player, 9, 2) == 'A');
+  assert(get_player_label(player, 2, frame) == 'C');
+
+  // cleans up
+  player_delete(player);
+  visibility_delete(vis);
+  grid_delete(main_grid);
+  grid_delete(base_grid);
+  printf("test_labels passed.\n");
+}
+
+
 /**************** test_calc_grid ****************/
 /* Tests calc_grid by using the wasd keys to move
  * a test player in main.txt for numMoves number 
@@ -139,15 +357,16 @@ void test_check_visible() {
 void test_calc_grid() {
   // initializes data structures
   grid_t* main_grid = grid_new("../maps/main.txt");
-  player_t* player = player_new("testplayer", 'T');
-  pos_t* player_pos = get_player_position(player);
+  visibility_t* vis = visibility_new(main_grid);
+  player_t* player = player_new("testplayer", 'T',
+                                grid_get_width(main_grid), grid_get_height(main_grid));
   // sets player position to (12,3) which is inside a room
-  set_position_x(player_pos, 12);
-  set_position_y(player_pos, 3);
+  pos_t player_pos = position_at(12, 3);
+  set_player_position(player, player_pos);
 
   // calculates and displays 
-  grid_t* perspective_grid = calc_grid(main_grid, player);
-  grid_print(perspective_grid);
+  calc_grid(main_grid, vis, player, NULL, NULL);
+  printf("%s", get_player_display(player));
 
   // updates player position and prints the perspective grid
   char ch;
@@ -155,28 +374,29 @@ void test_calc_grid() {
       ch = getchar();
 
       if (ch == 'w') {
-          set_position_y(player_pos, get_position_y(player_pos) - 1);
+          set_position_y(&player_pos, get_position_y(player_pos) - 1);
       } else if (ch == 's') {
-          set_position_y(player_pos, get_position_y(player_pos) + 1);
+          set_position_y(&player_pos, get_position_y(player_pos) + 1);
       } else if (ch == 'a') {
-          set_position_x(player_pos, get_position_x(player_pos) - 1);
+          set_position_x(&player_pos, get_position_x(player_pos) - 1);
       } else if (ch == 'd') {
-          set_position_x(player_pos, get_position_x(player_pos) + 1);
+          set_position_x(&player_pos, get_position_x(player_pos) + 1);
       } else if (ch != '\n') {
           printf("Invalid input. Use w, a, s, or d.\n");
       }
 
-      grid_delete(perspective_grid);
-      perspective_grid = calc_grid(main_grid, player);
-      grid_print(perspective_grid);
+      set_player_position(player, player_pos);
+      calc_grid(main_grid, vis, player, NULL, NULL);
+      printf("%s", get_player_display(player));
   }
 
   // asserts that the player position has symbol '@'
-  assert(grid_get_symbol(perspective_grid, player_pos) == '@');
+  assert(get_player_display_symbol(player, get_position_x(player_pos),
+                                   get_position_y(player_pos)) == '@');
 
   // cleans up
   player_delete(player);
-  grid_delete(perspective_grid);
+  visibility_delete(vis);
   grid_delete(main_grid);
   printf("test_calc_grid passed.\n");
 }
\ No newline at end of file